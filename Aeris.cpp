@@ -202,17 +202,17 @@ Weather::ReturnVals Aeris::InternalGetVals(const Weather::Settings & settings) c
 	EthernetClient client;
 
 	time_t rawtime;
-	struct tm * timeinfo;
+	struct tm timeinfo;
 	char yesterday[12];
 
 	time(&rawtime);
-	timeinfo = localtime(&rawtime);
-	timeinfo->tm_mday--;
+	localtime_r(&rawtime, &timeinfo);
+	timeinfo.tm_mday--;
 	// convert again to fix month wrapping
-	rawtime = mktime(timeinfo);
-	timeinfo = localtime(&rawtime);
+	rawtime = mktime(&timeinfo);
+	localtime_r(&rawtime, &timeinfo);
 
-	strftime(yesterday,sizeof(yesterday),"%m/%d/%Y", timeinfo);
+	strftime(yesterday,sizeof(yesterday),"%m/%d/%Y", &timeinfo);
 
 	trace("Yesterday: %s\n", yesterday);
 
@@ -0,0 +1,55 @@
+// Boards.h
+// What's wired where on each board the outputs can be driven on, one traits type for each.  Pins are
+//  wiringPi numbers on the Pi boards and Arduino pin numbers on the Arduino.  Board is the one built for;
+//  a new board is a new traits type here and a line choosing it.
+//
+
+#ifndef _BOARDS_h
+#define _BOARDS_h
+
+#include <inttypes.h>
+#include "config.h"
+
+// A Raspberry Pi with relays on wiringPi pins 0-15, or the OpenSprinkler Pi
+struct PiBoard
+{
+	// the pin of each direct output, the pump first
+	static constexpr uint8_t pins[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+	// the OpenSprinkler shift register
+	static constexpr bool bShiftRegister = true;
+	static constexpr uint8_t srClock = 7;
+	static constexpr uint8_t srEnable = 0;
+	static constexpr uint8_t srData = 2;
+	static constexpr uint8_t srLatch = 3;
+};
+
+// The GreenIQ V2, 6 zones
+struct GreenIQBoard
+{
+	static constexpr uint8_t pins[] = {5, 7, 0, 1, 2, 3, 4};
+	static constexpr bool bShiftRegister = false;
+};
+
+// An Arduino Mega with relays on pins 22-37
+struct ArduinoBoard
+{
+	static constexpr uint8_t pins[] = {22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37};
+	static constexpr bool bShiftRegister = false;
+};
+
+#if defined(ARDUINO)
+typedef ArduinoBoard Board;
+#elif defined(GREENIQ)
+typedef GreenIQBoard Board;
+#else
+typedef PiBoard Board;
+#endif
+
+// The direct outputs there are on board B: the pump and every zone, as far as there are pins
+template <class B>
+constexpr int DirectOutputs()
+{
+	return (NUM_ZONES + 1 < (int) sizeof(B::pins)) ? NUM_ZONES + 1 : (int) sizeof(B::pins);
+}
+
+#endif
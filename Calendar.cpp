@@ -0,0 +1,127 @@
+// Calendar.cpp
+// Works out which days each schedule runs on.
+//
+
+#include "Calendar.h"
+#include "settings.h"
+#include <string.h>
+
+// Month, day of month and length of that month for a day number (days since Jan 1 1970).
+//  See http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+static void DayOfMonth(long day, int * pMonth, int * pMday, int * pMonthDays)
+{
+	const long z = day + 719468;
+	const long era = (z >= 0 ? z : z - 146096) / 146097;
+	const long doe = z - era * 146097;
+	const long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const long mp = (5 * doy + 2) / 153;
+	const int m = mp < 10 ? mp + 3 : mp - 9;
+	const long y = yoe + era * 400 + (m <= 2);
+	static const uint8_t month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+	*pMonth = m;
+	*pMday = doy - (153 * mp + 2) / 5 + 1;
+	*pMonthDays = month_days[m - 1];
+	if ((m == 2) && ((y % 4 == 0) && ((y % 100 != 0) || (y % 400 == 0))))
+		*pMonthDays = 29;
+}
+
+// Repeat the low 'period' bits of pattern across the whole calendar.
+static CalendarDays Repeat(CalendarDays pattern, int period)
+{
+	for (int n = period; n < CALENDAR_DAYS; n *= 2)
+		pattern |= pattern << n;
+	return pattern;
+}
+
+Calendar::Calendar()
+{
+	for (int i = 0; i < MAX_SCHEDULES; i++)
+	{
+		m_cache[i].day = -1;
+		m_cache[i].rules = 0;
+		memset(&m_cache[i].cron, 0, sizeof(Cron));
+		m_cache[i].days = 0;
+	}
+}
+
+CalendarDays Calendar::Compile(const Schedule & sched, long day)
+{
+	if (!sched.IsEnabled())
+		return 0;
+
+	if (sched.IsCron())
+	{
+		int month, mday, month_days;
+		DayOfMonth(day, &month, &mday, &month_days);
+		CalendarDays days = 0;
+		for (int d = 0; d < CALENDAR_DAYS; d++)
+		{
+			if (sched.cron.MatchesDate(month, mday, (day + d + 4) % 7))
+				days |= (CalendarDays) 1 << d;
+			if (++mday > month_days)
+				DayOfMonth(day + d + 1, &month, &mday, &month_days);
+		}
+		return days;
+	}
+
+	if (sched.IsInterval())
+	{
+		if (sched.interval == 0)
+			return 0;
+		CalendarDays days = 0;
+		for (int d = (sched.interval - day % sched.interval) % sched.interval; d < CALENDAR_DAYS; d += sched.interval)
+			days |= (CalendarDays) 1 << d;
+		return days;
+	}
+
+	// day & 0x01 is Sunday, and Jan 1 1970 was a Thursday
+	const int first_weekday = (day + 4) % 7;
+	CalendarDays week = 0;
+	for (int d = 0; d < 7; d++)
+		if (sched.day & (0x01 << ((first_weekday + d) % 7)))
+			week |= (CalendarDays) 1 << d;
+	CalendarDays days = Repeat(week, 7);
+
+	const uint8_t restrictions = sched.GetRestriction();
+	if (restrictions != 0)
+	{
+		int month, mday, month_days;
+		DayOfMonth(day, &month, &mday, &month_days);
+		CalendarDays parity = 0;
+		for (int d = 0; d < CALENDAR_DAYS; d++)
+		{
+			if ((mday % 2) == (restrictions % 2))
+				parity |= (CalendarDays) 1 << d;
+			if (++mday > month_days)
+				DayOfMonth(day + d + 1, &month, &mday, &month_days);
+		}
+		days &= parity;
+	}
+	return days;
+}
+
+CalendarDays Calendar::Days(uint8_t sched_num, const Schedule & sched, const TimeContext & now)
+{
+	const long day = now.day;
+	if (sched_num >= MAX_SCHEDULES)
+		return Compile(sched, day);
+
+	const uint16_t rules = sched.day | (sched.IsEnabled() << 8) | (sched.IsInterval() << 9) | (sched.GetRestriction() << 10) | (sched.IsCron() << 12);
+	Entry & entry = m_cache[sched_num];
+	if ((entry.day != day) || (entry.rules != rules) || (sched.IsCron() && (memcmp(&entry.cron, &sched.cron, sizeof(Cron)) != 0)))
+	{
+		entry.day = day;
+		entry.rules = rules;
+		entry.cron = sched.cron;
+		entry.days = Compile(sched, day);
+	}
+	return entry.days;
+}
+
+int Calendar::DaysUntilRun(CalendarDays days)
+{
+	if (days == 0)
+		return -1;
+	return __builtin_ctzll(days);
+}
@@ -0,0 +1,43 @@
+// Calendar.h
+// Works out which days each schedule runs on.  A schedule's interval, day of week and odd/even rules,
+//  or the day fields of its cron expression, are compiled into a bitset covering the next CALENDAR_DAYS
+//  days, so whole date ranges can be checked with a few bit operations.  The bitsets are cached until
+//  the schedule or the date changes.
+//
+
+#ifndef _CALENDAR_h
+#define _CALENDAR_h
+
+#include <inttypes.h>
+#include "config.h"
+#include "port.h"
+#include "Cron.h"
+
+class Schedule;
+
+// one bit per day, bit 0 is today
+typedef uint64_t CalendarDays;
+#define CALENDAR_DAYS 64
+
+class Calendar
+{
+public:
+	Calendar();
+	// The days schedule sched_num runs on, starting today.
+	CalendarDays Days(uint8_t sched_num, const Schedule & sched, const TimeContext & now);
+	// Compile a schedule's rules for the days starting at day (days since Jan 1 1970).
+	static CalendarDays Compile(const Schedule & sched, long day);
+	// Days from bit 0 until the first run, or -1 if it doesn't run within the calendar.
+	static int DaysUntilRun(CalendarDays days);
+private:
+	struct Entry
+	{
+		long day;
+		uint16_t rules;
+		Cron cron;
+		CalendarDays days;
+	};
+	Entry m_cache[MAX_SCHEDULES];
+};
+
+#endif
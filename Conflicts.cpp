@@ -0,0 +1,161 @@
+// Conflicts.cpp
+// Finds schedules whose runs overlap.
+//
+
+#include "Conflicts.h"
+#include "Calendar.h"
+#include "Solar.h"
+#include "settings.h"
+#include "Controller.h"
+#include <stdlib.h>
+
+IntervalIndex::IntervalIndex()
+		: m_count(0)
+{
+}
+
+static int CompareStart(const void * a, const void * b)
+{
+	const RunWindow * wa = (const RunWindow *) a;
+	const RunWindow * wb = (const RunWindow *) b;
+	if (wa->start != wb->start)
+		return (wa->start < wb->start) ? -1 : 1;
+	return wa->sched - wb->sched;
+}
+
+void IntervalIndex::Build(const RunWindow * windows, int count)
+{
+	m_count = spi_min(count, MAX_WINDOWS);
+	for (int i = 0; i < m_count; i++)
+		m_windows[i] = windows[i];
+	qsort(m_windows, m_count, sizeof(RunWindow), CompareStart);
+	BuildMaxEnd(0, m_count);
+}
+
+// The node for [lo, hi) is the middle window, with the left and right halves as its children.
+time_t IntervalIndex::BuildMaxEnd(int lo, int hi)
+{
+	if (lo >= hi)
+		return 0;
+	const int mid = (lo + hi) / 2;
+	m_maxEnd[mid] = spi_max(m_windows[mid].end, spi_max(BuildMaxEnd(lo, mid), BuildMaxEnd(mid + 1, hi)));
+	return m_maxEnd[mid];
+}
+
+int IntervalIndex::Find(time_t start, time_t end, const RunWindow ** found, int max_found) const
+{
+	int count = 0;
+	Find(0, m_count, start, end, found, max_found, &count);
+	return count;
+}
+
+void IntervalIndex::Find(int lo, int hi, time_t start, time_t end, const RunWindow ** found, int max_found, int * count) const
+{
+	if ((lo >= hi) || (*count >= max_found))
+		return;
+	const int mid = (lo + hi) / 2;
+	// nothing under this node finishes after the start
+	if (m_maxEnd[mid] <= start)
+		return;
+	Find(lo, mid, start, end, found, max_found, count);
+	// this window and everything to the right of it start too late
+	if (m_windows[mid].start >= end)
+		return;
+	if ((m_windows[mid].end > start) && (*count < max_found))
+		found[(*count)++] = &m_windows[mid];
+	Find(mid + 1, hi, start, end, found, max_found, count);
+}
+
+// A cron start that comes up while the schedule is still running waits for it to finish, the ones
+//  in between are skipped.
+static int AddCronWindows(uint8_t sched_num, const Cron & cron, time_t day_start, long length, RunWindow * windows, int count, int max_windows)
+{
+	long free_time = 0;
+	for (short minute = cron.NextMinute(-1); (minute != -1) && (count < max_windows); )
+	{
+		const long start = spi_max(minute * 60L, free_time);
+		if (start >= (long)SECS_PER_DAY)
+			break;
+		windows[count].sched = sched_num;
+		windows[count].start = day_start + start;
+		windows[count].end = windows[count].start + length;
+		count++;
+		free_time = start + length;
+		minute = cron.NextMinute(start / 60);
+	}
+	return count;
+}
+
+int BuildRunWindows(const TimeContext & now, RunWindow * windows, int max_windows)
+{
+	const time_t today = previousMidnight(now.local);
+	const uint8_t iNumSchedules = GetNumSchedules();
+	ZoneRun runs[NUM_ZONES * MAX_CYCLES];
+	int count = 0;
+	for (uint8_t i = 0; i < iNumSchedules; i++)
+	{
+		Schedule sched;
+		LoadSchedule(i, &sched);
+		const CalendarDays days = controller->m_calendar.Days(i, sched, now);
+		if (!days)
+			continue;
+
+		// the run takes just as long whatever time it starts
+		ProjectDurations(&sched, true);
+		const int iNumRuns = BuildZoneRuns(sched, 0, runs, NUM_ZONES * MAX_CYCLES);
+		long length = 0;
+		for (int k = 0; k < iNumRuns; k++)
+			length = spi_max(length, runs[k].end);
+		if (length == 0)
+			continue;
+
+		for (int d = 0; d < CONFLICT_DAYS; d++)
+		{
+			if (!(days & ((CalendarDays) 1 << d)))
+				continue;
+			if (sched.IsCron())
+			{
+				count = AddCronWindows(i, sched.cron, today + d * SECS_PER_DAY, length, windows, count, max_windows);
+				continue;
+			}
+			for (uint8_t j = 0; j <= 3; j++)
+			{
+				const short start_minute = StartMinute(sched.time[j], now.day + d, now.offset);
+				if ((start_minute == -1) || (count >= max_windows))
+					continue;
+				windows[count].sched = i;
+				windows[count].start = today + d * SECS_PER_DAY + start_minute * 60L;
+				windows[count].end = windows[count].start + length;
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+int FindConflicts(uint8_t sched_num, const TimeContext & now, Conflict * conflicts, int max_conflicts)
+{
+	static RunWindow windows[MAX_WINDOWS];
+	static IntervalIndex index;
+	static const RunWindow * found[MAX_WINDOWS];
+	const int iNumWindows = BuildRunWindows(now, windows, MAX_WINDOWS);
+	index.Build(windows, iNumWindows);
+
+	int count = 0;
+	for (int i = 0; (i < iNumWindows) && (count < max_conflicts); i++)
+	{
+		if (windows[i].sched != sched_num)
+			continue;
+		const int iNumFound = index.Find(windows[i].start, windows[i].end, found, MAX_WINDOWS);
+		for (int k = 0; (k < iNumFound) && (count < max_conflicts); k++)
+		{
+			// a window always overlaps itself
+			if ((found[k]->sched == sched_num) && (found[k]->start == windows[i].start))
+				continue;
+			conflicts[count].window = windows[i];
+			conflicts[count].other = *found[k];
+			count++;
+		}
+	}
+	return count;
+}
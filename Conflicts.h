@@ -0,0 +1,55 @@
+// Conflicts.h
+// Finds schedules whose runs overlap.  Every start time of every schedule over the next week is
+//  turned into a run window, the windows go into an interval tree, and a schedule's windows are
+//  checked against it.  Overlapping runs would otherwise only show up as a start being pushed back
+//  while the other schedule finishes.  A cron schedule that starts many times a day can use up the
+//  windows, and any past MAX_WINDOWS aren't checked.
+//
+
+#ifndef _CONFLICTS_h
+#define _CONFLICTS_h
+
+#include <inttypes.h>
+#include "config.h"
+#include "port.h"
+
+#define CONFLICT_DAYS 7
+#define MAX_WINDOWS (MAX_SCHEDULES * 4 * CONFLICT_DAYS)
+
+// A schedule's run from one start time.  Times are local, in seconds since 1970.
+struct RunWindow
+{
+	uint8_t sched;
+	time_t start;
+	time_t end;
+};
+
+struct Conflict
+{
+	RunWindow window;	// the run of the schedule being checked
+	RunWindow other;	// the run it overlaps
+};
+
+// A static interval tree: the windows sorted by start time, treated as a balanced binary tree,
+//  with each node holding the latest end time under it.
+class IntervalIndex
+{
+public:
+	IntervalIndex();
+	void Build(const RunWindow * windows, int count);
+	// Hand back the windows that overlap [start, end), returns how many were found
+	int Find(time_t start, time_t end, const RunWindow ** found, int max_found) const;
+private:
+	time_t BuildMaxEnd(int lo, int hi);
+	void Find(int lo, int hi, time_t start, time_t end, const RunWindow ** found, int max_found, int * count) const;
+	RunWindow m_windows[MAX_WINDOWS];
+	time_t m_maxEnd[MAX_WINDOWS];
+	int m_count;
+};
+
+// Work out the run windows for the week starting today
+int BuildRunWindows(const TimeContext & now, RunWindow * windows, int max_windows);
+// Find the runs of schedule sched_num that overlap runs of any schedule
+int FindConflicts(uint8_t sched_num, const TimeContext & now, Conflict * conflicts, int max_conflicts);
+
+#endif
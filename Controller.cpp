@@ -0,0 +1,42 @@
+// Controller.cpp
+// The controllers run by this process.
+//
+
+#include "Controller.h"
+#include <string.h>
+#include <sys/stat.h>
+
+Controller::Controller(int id, const char * dir)
+		: m_id(id), m_bStarted(false), m_eeprom(dir),
+#ifndef ARDUINO
+		  m_journal(dir),
+#endif
+		  m_iNumEvents(0), m_output(0), m_lastWeatherScale(-1)
+{
+	strncpy(m_dir, dir, sizeof(m_dir) - 1);
+	m_dir[sizeof(m_dir) - 1] = 0;
+}
+
+static Controller firstController(0, "");
+Controller * controller = &firstController;
+Controller * controllers[MAX_CONTROLLERS] = {&firstController};
+int iNumControllers = 1;
+
+Controller * AddController()
+{
+	if (iNumControllers >= MAX_CONTROLLERS)
+		return 0;
+	char dir[CONTROLLER_DIR_SIZE];
+	snprintf(dir, sizeof(dir), "c%d/", iNumControllers);
+	mkdir(dir, 0755);
+	trace(F("Adding controller %d in %s\n"), iNumControllers, dir);
+	controllers[iNumControllers] = new Controller(iNumControllers, dir);
+	return controllers[iNumControllers++];
+}
+
+Controller * GetController(int id)
+{
+	if ((id < 0) || (id >= iNumControllers))
+		return 0;
+	return controllers[id];
+}
@@ -0,0 +1,61 @@
+// Controller.h
+// Everything one controller keeps: its settings, schedules, run state, outputs and logs.  Any number of
+//  them can be run by the one process, sharing the clock and the web server, so one host can look after
+//  the zones of several boards.  The code works on the current controller's members through controller,
+//  e.g. controller->m_runState.
+//
+
+#ifndef _CONTROLLER_h
+#define _CONTROLLER_h
+
+#include "core.h"
+#include "settings.h"
+#include "Event.h"
+#include "Calendar.h"
+#include "Solar.h"
+#include "Output.h"
+#ifndef ARDUINO
+#include "Journal.h"
+#endif
+
+class Controller
+{
+public:
+	// dir is where its files are kept, "" for the working directory
+	Controller(int id, const char * dir);
+	int m_id;
+	char m_dir[CONTROLLER_DIR_SIZE];
+	bool m_bStarted;
+	EEPROMClass m_eeprom;
+#ifdef LOGGING
+	Logging m_logger;
+#endif
+#ifndef ARDUINO
+	Journal m_journal;
+#endif
+	runStateClass m_runState;
+	Event m_events[MAX_EVENTS];
+	int m_iNumEvents;
+	Schedule m_quickSchedule;
+	Calendar m_calendar;
+	SolarTable m_solarTable;
+	// what drives the outputs, for the output type chosen
+	Output * m_output;
+	ZoneSet m_outState;
+	ZoneSet m_prevOutState;
+	// the weather scale from the last time a schedule was adjusted, -1 if there hasn't been one
+	int16_t m_lastWeatherScale;
+};
+
+// The controller being run, or that a web request is for
+extern Controller * controller;
+// Controller 0 keeps its files in the working directory and is always there
+extern Controller * controllers[MAX_CONTROLLERS];
+extern int iNumControllers;
+
+// Add a controller, keeping its files in c<id>/.  Returns 0 if there are already MAX_CONTROLLERS.
+Controller * AddController();
+// The controller with this id, or 0
+Controller * GetController(int id);
+
+#endif
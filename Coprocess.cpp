@@ -0,0 +1,221 @@
+// Coprocess.cpp
+// Drives the outputs through a script that's kept running.
+//
+
+#include "Coprocess.h"
+#include "port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// A script that won't start or keeps dying is tried again after a second, then waiting twice as long
+//  each time up to a minute.
+#define RETRY_MIN_MS 1000
+#define RETRY_MAX_MS 60000
+// an acknowledgement slower than this is worth a line in the log
+#define SLOW_ACK_MS 1000
+
+Coprocess::Coprocess(const char * path, int controller_id)
+		: m_controller(controller_id), m_pid(0), m_toScript(-1), m_fromScript(-1), m_bSent(true), m_sequence(0), m_acked(0),
+		  m_lastLatency(-1), m_maxLatency(-1), m_restarts(0), m_lastStart(0), m_retryMs(RETRY_MIN_MS), m_lineLen(0)
+{
+	strncpy(m_path, path, sizeof(m_path) - 1);
+	m_path[sizeof(m_path) - 1] = 0;
+}
+
+Coprocess::~Coprocess()
+{
+	Stop();
+}
+
+bool Coprocess::Setup()
+{
+	if (IsRunning())
+		return true;
+	m_retryMs = RETRY_MIN_MS;
+	// if it won't start now it's tried again from Poll
+	Launch();
+	return true;
+}
+
+void Coprocess::Stop()
+{
+	m_path[0] = 0;
+	if (!IsRunning())
+		return;
+	// a script that's done with its input should finish up on its own
+	close(m_toScript);
+	close(m_fromScript);
+	m_toScript = m_fromScript = -1;
+	kill(m_pid, SIGTERM);
+	for (int i = 0; (i < 100) && (waitpid(m_pid, 0, WNOHANG) == 0); i++)
+		usleep(10000);
+	if (waitpid(m_pid, 0, WNOHANG) == 0)
+	{
+		kill(m_pid, SIGKILL);
+		waitpid(m_pid, 0, 0);
+	}
+	m_pid = 0;
+}
+
+bool Coprocess::Launch()
+{
+	m_lastStart = NowMs();
+	if (access(m_path, X_OK) != 0)
+	{
+		trace(F("Can't run %s (%s)\n"), m_path, strerror(errno));
+		return false;
+	}
+	int to[2], from[2];
+	if (pipe(to) != 0)
+		return false;
+	if (pipe(from) != 0)
+	{
+		close(to[0]);
+		close(to[1]);
+		return false;
+	}
+	const pid_t pid = fork();
+	if (pid == 0)
+	{
+		dup2(to[0], STDIN_FILENO);
+		dup2(from[1], STDOUT_FILENO);
+		close(to[0]);
+		close(to[1]);
+		close(from[0]);
+		close(from[1]);
+		char zones[8], id[8];
+		snprintf(zones, sizeof(zones), "%d", NUM_ZONES);
+		snprintf(id, sizeof(id), "%d", m_controller);
+		execl(m_path, m_path, zones, id, (char *) NULL);
+		_exit(127);
+	}
+	close(to[0]);
+	close(from[1]);
+	if (pid < 0)
+	{
+		trace(F("Failed to start %s (%s)\n"), m_path, strerror(errno));
+		close(to[1]);
+		close(from[0]);
+		return false;
+	}
+	m_pid = pid;
+	m_toScript = to[1];
+	m_fromScript = from[0];
+	// don't hold up the main loop on the script, and don't hand the pipes to anything else started
+	fcntl(m_toScript, F_SETFL, O_NONBLOCK);
+	fcntl(m_fromScript, F_SETFL, O_NONBLOCK);
+	fcntl(m_toScript, F_SETFD, FD_CLOEXEC);
+	fcntl(m_fromScript, F_SETFD, FD_CLOEXEC);
+	m_lineLen = 0;
+	trace(F("Started %s (pid %d)\n"), m_path, (int) pid);
+	// the new script doesn't know the outputs yet
+	m_bSent = false;
+	return Write();
+}
+
+void Coprocess::Died()
+{
+	if (m_toScript >= 0)
+		close(m_toScript);
+	if (m_fromScript >= 0)
+		close(m_fromScript);
+	m_toScript = m_fromScript = -1;
+	if (m_pid > 0)
+	{
+		kill(m_pid, SIGKILL);
+		waitpid(m_pid, 0, 0);
+	}
+	m_pid = 0;
+	m_bSent = false;
+	// those waiting on an acknowledgement won't get one now
+	m_acked = m_sequence;
+}
+
+bool Coprocess::Write()
+{
+	if (!IsRunning())
+		return false;
+	// the outputs in hex, most significant digit first
+	char line[16 + NUM_ZONES / 4];
+	int len = snprintf(line, sizeof(line), "%u ", (unsigned) (m_sequence + 1));
+	for (int digit = NUM_ZONES / 4; digit >= 0; digit--)
+	{
+		int nibble = 0;
+		for (int bit = digit * 4 + 3; bit >= digit * 4; bit--)
+			nibble = (nibble << 1) | ((bit <= NUM_ZONES) && m_state.Test(bit));
+		line[len++] = "0123456789abcdef"[nibble];
+	}
+	line[len++] = '\n';
+	// a line is well under PIPE_BUF, so it goes in whole or not at all
+	if (write(m_toScript, line, len) != len)
+	{
+		trace(F("%s isn't taking the outputs (%s)\n"), m_path, strerror(errno));
+		Died();
+		return false;
+	}
+	m_sequence++;
+	m_sentAt[m_sequence % (sizeof(m_sentAt) / sizeof(m_sentAt[0]))] = NowMs();
+	m_bSent = true;
+	return true;
+}
+
+void Coprocess::Latch(const ZoneSet & state)
+{
+	m_state = state;
+	m_bSent = false;
+	Write();
+}
+
+void Coprocess::Poll()
+{
+	if (IsRunning())
+	{
+		char buf[64];
+		ssize_t len;
+		while ((len = read(m_fromScript, buf, sizeof(buf))) > 0)
+		{
+			for (ssize_t i = 0; i < len; i++)
+			{
+				if (buf[i] != '\n')
+				{
+					if (m_lineLen < (int) sizeof(m_line) - 1)
+						m_line[m_lineLen++] = buf[i];
+					continue;
+				}
+				m_line[m_lineLen] = 0;
+				m_lineLen = 0;
+				const uint32_t seq = strtoul(m_line, 0, 10);
+				// only ones sent to this script, and still in m_sentAt
+				if ((seq - m_acked - 1 >= m_sequence - m_acked) || (m_sequence - seq >= sizeof(m_sentAt) / sizeof(m_sentAt[0])))
+					continue;
+				m_acked = seq;
+				m_lastLatency = NowMs() - m_sentAt[seq % (sizeof(m_sentAt) / sizeof(m_sentAt[0]))];
+				m_maxLatency = spi_max(m_maxLatency, m_lastLatency);
+				m_retryMs = RETRY_MIN_MS;
+				if (m_lastLatency > SLOW_ACK_MS)
+					trace(F("%s took %ld ms to switch the outputs\n"), m_path, m_lastLatency);
+			}
+		}
+		// anything it acknowledged on the way out has been read, so see if it's gone
+		int status;
+		if (waitpid(m_pid, &status, WNOHANG) == m_pid)
+		{
+			trace(F("%s exited (%d)\n"), m_path, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+			// it's been waited for already
+			m_pid = 0;
+			Died();
+		}
+	}
+	else if (m_path[0] && (NowMs() - m_lastStart >= m_retryMs))
+	{
+		m_restarts++;
+		Launch();
+		// until it acknowledges something, wait longer each time
+		m_retryMs = spi_min(m_retryMs * 2, RETRY_MAX_MS);
+	}
+}
@@ -0,0 +1,66 @@
+// Coprocess.h
+// Drives the outputs through a script that's started once and kept running, rather than run once for
+//  every zone each time the outputs change.  Each change is one line down a pipe to the script:
+//
+//    <sequence number> <outputs>
+//
+//  where outputs is hex with a bit for each output, bit 0 the pump and bit n zone n.  The script writes
+//  the sequence number back on a line of its own once it has switched the outputs, which is used to
+//  time it.  If the script dies or stops reading it's started again and sent the outputs as they are.
+//
+
+#ifndef _COPROCESS_h
+#define _COPROCESS_h
+
+#include <inttypes.h>
+#include <sys/types.h>
+#include "ZoneSet.h"
+#include "Output.h"
+
+class Coprocess : public Output
+{
+public:
+	// The script's given the number of zones and the controller
+	Coprocess(const char * path, int controller_id);
+	~Coprocess();
+	// Start the script if it isn't running
+	bool Setup();
+	void Stop();
+	// Send the outputs, or keep them for when the script has been started again if it's died
+	void Latch(const ZoneSet & state);
+	// Read any acknowledgements that have come back, and start the script again if it's died
+	void Poll();
+	bool IsRunning() const { return m_pid > 0; }
+	// milliseconds the script took to acknowledge the last change and the slowest one, -1 before there's been one
+	long LastLatency() const { return m_lastLatency; }
+	long MaxLatency() const { return m_maxLatency; }
+	// changes sent that haven't been acknowledged yet
+	uint32_t Outstanding() const { return m_sequence - m_acked; }
+	int Restarts() const { return m_restarts; }
+private:
+	bool Launch();
+	bool Write();
+	void Died();
+	char m_path[64];
+	int m_controller;
+	pid_t m_pid;
+	int m_toScript;
+	int m_fromScript;
+	// the outputs to send, and whether the script has them yet
+	ZoneSet m_state;
+	bool m_bSent;
+	uint32_t m_sequence;
+	uint32_t m_acked;
+	// when each of the last few changes was sent, in milliseconds
+	long m_sentAt[8];
+	long m_lastLatency;
+	long m_maxLatency;
+	int m_restarts;
+	long m_lastStart;
+	// how long to wait before starting the script again after it's died
+	long m_retryMs;
+	char m_line[32];
+	int m_lineLen;
+};
+
+#endif
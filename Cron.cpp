@@ -0,0 +1,195 @@
+// Cron.cpp
+// Cron style schedule expressions.
+//
+
+#include "Cron.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Parse one field into a bitmask of the values from lo to hi it allows.
+//  Returns a pointer past the field, or NULL if it doesn't parse.
+static const char * ParseField(const char * str, int lo, int hi, uint64_t * pBits, bool * pAny)
+{
+	*pBits = 0;
+	*pAny = (*str == '*');
+	while (true)
+	{
+		int first, last, step = 1;
+		char * end;
+		if (*str == '*')
+		{
+			first = lo;
+			last = hi;
+			str++;
+		}
+		else
+		{
+			first = strtol(str, &end, 10);
+			if (end == str)
+				return NULL;
+			last = first;
+			str = end;
+			if (*str == '-')
+			{
+				last = strtol(++str, &end, 10);
+				if (end == str)
+					return NULL;
+				str = end;
+			}
+		}
+		if (*str == '/')
+		{
+			step = strtol(++str, &end, 10);
+			if ((end == str) || (step <= 0))
+				return NULL;
+			str = end;
+			// n/step runs to the end of the field, like n-hi/step
+			if (first == last)
+				last = hi;
+		}
+		if ((first < lo) || (last > hi) || (first > last))
+			return NULL;
+		for (int i = first; i <= last; i += step)
+			*pBits |= (uint64_t) 1 << i;
+		if (*str != ',')
+			break;
+		str++;
+	}
+	if ((*str != ' ') && (*str != 0))
+		return NULL;
+	while (*str == ' ')
+		str++;
+	return str;
+}
+
+bool Cron::Parse(const char * expr)
+{
+	uint64_t bits[5];
+	bool bAny[5];
+	static const uint8_t limits[5][2] = {{0, 59}, {0, 23}, {1, 31}, {1, 12}, {0, 7}};
+	while (*expr == ' ')
+		expr++;
+	for (int i = 0; i < 5; i++)
+	{
+		if (*expr == 0)
+			return false;
+		expr = ParseField(expr, limits[i][0], limits[i][1], &bits[i], &bAny[i]);
+		if (!expr)
+			return false;
+	}
+	if (*expr != 0)
+		return false;
+
+	minute[0] = bits[0] & 0xFFFFFFFF;
+	minute[1] = bits[0] >> 32;
+	hour = bits[1];
+	mday = bits[2];
+	month = bits[3];
+	// 7 is Sunday as well
+	wday = (bits[4] | (bits[4] >> 7)) & 0x7F;
+	flags = (bAny[2] ? CRON_ANY_MDAY : 0) | (bAny[4] ? CRON_ANY_WDAY : 0);
+	return true;
+}
+
+// Whether a field can be written as * or */step.  On the day fields that changes which days match,
+//  so it has to be the same as it was in the expression parsed.
+enum StarForm
+{
+	STAR_ALLOWED, STAR_NEVER, STAR_ALWAYS
+};
+
+// Write out the values of one field, as * or */step where that's allowed and covers them, otherwise
+//  as a list of values and ranges.
+static int FormatField(char * str, int len, uint64_t bits, int lo, int hi, StarForm star)
+{
+	// a single value reads better as itself
+	if ((star == STAR_ALWAYS) || ((star == STAR_ALLOWED) && (bits & (bits - 1))))
+	{
+		for (int step = 1; step <= hi - lo + 1; step++)
+		{
+			uint64_t stepped = 0;
+			for (int i = lo; i <= hi; i += step)
+				stepped |= (uint64_t) 1 << i;
+			// day of week 7 is Sunday
+			if (hi == 7)
+				stepped = (stepped | (stepped >> 7)) & 0x7F;
+			if (stepped == bits)
+				return (step == 1) ? snprintf(str, len, "*") : snprintf(str, len, "*/%d", step);
+		}
+	}
+
+	int count = 0;
+	str[0] = 0;
+	for (int i = lo; i <= hi; i++)
+	{
+		if (!(bits & ((uint64_t) 1 << i)))
+			continue;
+		int last = i;
+		while ((last < hi) && (bits & ((uint64_t) 1 << (last + 1))))
+			last++;
+		const int n = (last > i) ? snprintf(str + count, len - count, "%s%d-%d", count ? "," : "", i, last)
+				: snprintf(str + count, len - count, "%s%d", count ? "," : "", i);
+		if ((n < 0) || (count + n >= len))
+			break;
+		count += n;
+		i = last;
+	}
+	return count;
+}
+
+int Cron::Format(char * str, int len) const
+{
+	const uint64_t bits[5] = {((uint64_t) minute[1] << 32) | minute[0], hour, mday, month, wday};
+	const StarForm star[5] = {STAR_ALLOWED, STAR_ALLOWED, (flags & CRON_ANY_MDAY) ? STAR_ALWAYS : STAR_NEVER, STAR_ALLOWED,
+			(flags & CRON_ANY_WDAY) ? STAR_ALWAYS : STAR_NEVER};
+	static const uint8_t limits[5][2] = {{0, 59}, {0, 23}, {1, 31}, {1, 12}, {0, 7}};
+	int count = 0;
+	for (int i = 0; (i < 5) && (count < len - 1); i++)
+	{
+		if (i > 0)
+			str[count++] = ' ';
+		count += FormatField(str + count, len - count, bits[i], limits[i][0], limits[i][1], star[i]);
+	}
+	str[count] = 0;
+	return count;
+}
+
+bool Cron::MatchesDate(int month_num, int mday_num, int wday_num) const
+{
+	if (!(month & (0x01 << month_num)))
+		return false;
+	const bool bMday = mday & ((uint32_t) 1 << mday_num);
+	const bool bWday = wday & (0x01 << wday_num);
+	if (flags & (CRON_ANY_MDAY | CRON_ANY_WDAY))
+		return bMday && bWday;
+	return bMday || bWday;
+}
+
+short Cron::NextMinute(int after) const
+{
+	const uint64_t minutes = ((uint64_t) minute[1] << 32) | minute[0];
+	if (!minutes)
+		return -1;
+	int h = (after + 1) / 60;
+	int m = (after + 1) % 60;
+	while (h < 24)
+	{
+		// skip straight to the next hour it runs in
+		const uint32_t hours = hour >> h;
+		if (!hours)
+			return -1;
+		const int next_hour = h + __builtin_ctz(hours);
+		if (next_hour != h)
+		{
+			h = next_hour;
+			m = 0;
+		}
+		const uint64_t later = minutes >> m;
+		if (later)
+			return h * 60 + m + __builtin_ctzll(later);
+		h++;
+		m = 0;
+	}
+	return -1;
+}
@@ -0,0 +1,38 @@
+// Cron.h
+// Cron style schedule expressions: minute hour day-of-month month day-of-week.  Each field is kept as a
+//  bitmask of the values it allows, so the days a schedule runs on compile straight into a Calendar and
+//  the next start in a day is a couple of bit scans rather than a walk through every minute.
+//
+
+#ifndef _CRON_h
+#define _CRON_h
+
+#include <inttypes.h>
+
+#define CRON_ANY_MDAY	0x01	// the day of month field was '*'
+#define CRON_ANY_WDAY	0x02	// the day of week field was '*'
+
+// Kept in the schedule's EEPROM slot, so it has to stay plain data.
+struct Cron
+{
+	uint32_t minute[2];	// bits 0-59, minute[0] holds 0-31
+	uint32_t hour;		// bits 0-23
+	uint32_t mday;		// bits 1-31
+	uint16_t month;		// bits 1-12
+	uint8_t wday;		// bits 0-6, Sunday is 0
+	uint8_t flags;
+
+	// Parse "m h dom mon dow".  A field is a comma list of *, n or n-m, each with an optional /step.
+	//  Day of week 7 is Sunday as well.
+	bool Parse(const char * expr);
+	// Write the expression back out
+	int Format(char * str, int len) const;
+	// Like cron, if both day fields are restricted a day matching either of them will do.
+	//  month and mday count from 1, wday from 0 for Sunday.
+	bool MatchesDate(int month, int mday, int wday) const;
+	// The first minute past midnight after minute 'after' that it starts at, or -1 if there isn't one
+	//  that day.  An after of -1 gives the first start of the day.
+	short NextMinute(int after) const;
+};
+
+#endif
@@ -1,12 +0,0 @@
-// Event.cpp
-// This defines the Event Object used for timing in the Sprinkling System.
-// Author: Richard Zimmerman
-// Copyright (c) 2013 Richard Zimmerman
-//
-
-#include "Event.h"
-
-// global for the events structure.
-Event events[MAX_EVENTS];
-int iNumEvents = 0;
-
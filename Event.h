@@ -8,17 +8,18 @@
 #define _EVENT_h
 
 #include <inttypes.h>
+#include "config.h"
+
 class Event
 {
 public:
-	short time;
+	long time;		// seconds past local midnight, -1 once the event has been processed
 	uint8_t command;
 	uint8_t data[3];
+	long end;		// zone on events: seconds past local midnight to turn the zone off
 };
 
-#define MAX_EVENTS 60
-
-extern Event events[];
-extern int iNumEvents;
+// enough for every start time plus an on and an off event for each cycle of the running schedule
+#define MAX_EVENTS (MAX_SCHEDULES * 4 + NUM_ZONES * MAX_CYCLES * 2 + 1)
 
 #endif
@@ -0,0 +1,118 @@
+// FlowMeter.cpp
+// Counts the pulses from a flow meter.
+//
+
+#include "FlowMeter.h"
+#include "port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+// events the kernel holds for the line while the thread catches up, the most it allows
+#define EVENT_BUFFER 1024
+// how often the thread looks to see if it's been stopped
+#define STOP_POLL_MS 200
+// with no pulse for this long, or twice the last period if that's longer, the water's stopped
+#define STOPPED_NS 2000000000ULL
+
+FlowMeter flowMeter;
+
+FlowMeter::FlowMeter() : m_fd(-1), m_bCounting(false), m_bStop(false), m_pulses(0), m_lastNs(0), m_periodNs(0)
+{
+}
+
+FlowMeter::~FlowMeter()
+{
+	Stop();
+}
+
+bool FlowMeter::Start(const char * chip, uint8_t line)
+{
+	Stop();
+	const int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0)
+	{
+		trace(F("Can't open %s (%s)\n"), chip, strerror(errno));
+		return false;
+	}
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = line;
+	strncpy(req.consumer, "sprinklers_pi", sizeof(req.consumer) - 1);
+	req.num_lines = 1;
+	req.event_buffer_size = EVENT_BUFFER;
+	// no debounce, that would limit the rate; one edge is one pulse
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+	const int ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(chip_fd);
+	if (ret < 0)
+	{
+		trace(F("Can't get the flow meter line %d from %s (%s)\n"), line, chip, strerror(errno));
+		return false;
+	}
+	m_fd = req.fd;
+	m_bStop = false;
+	m_bCounting = true;
+	m_thread = std::thread(&FlowMeter::Run, this);
+	trace(F("Counting the flow meter on line %d\n"), line);
+	return true;
+}
+
+void FlowMeter::Stop()
+{
+	if (m_thread.joinable())
+	{
+		m_bStop = true;
+		m_thread.join();
+	}
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+}
+
+void FlowMeter::Feed(uint32_t pulses)
+{
+	m_bCounting = true;
+	m_pulses.fetch_add(pulses, std::memory_order_relaxed);
+}
+
+uint32_t FlowMeter::Rate() const
+{
+	const uint64_t period = m_periodNs.load(std::memory_order_relaxed);
+	if (period == 0)
+		return 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	const uint64_t now = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	if (now - m_lastNs.load(std::memory_order_relaxed) > spi_max(STOPPED_NS, 2 * period))
+		return 0;
+	return 60000000000ULL / period;
+}
+
+void FlowMeter::Run()
+{
+	struct gpio_v2_line_event events[64];
+	struct pollfd fd = {m_fd, POLLIN, 0};
+	uint64_t last = 0;
+	while (!m_bStop)
+	{
+		if (poll(&fd, 1, STOP_POLL_MS) <= 0)
+			continue;
+		const ssize_t len = read(m_fd, events, sizeof(events));
+		if (len < (ssize_t) sizeof(events[0]))
+			continue;
+		const size_t n = len / sizeof(events[0]);
+		m_pulses.fetch_add(n, std::memory_order_relaxed);
+		// the kernel stamps each edge as it comes, so the period doesn't depend on when it's read
+		const uint64_t prev = (n > 1) ? events[n - 2].timestamp_ns : last;
+		last = events[n - 1].timestamp_ns;
+		if (prev)
+			m_periodNs.store(last - prev, std::memory_order_relaxed);
+		m_lastNs.store(last, std::memory_order_relaxed);
+	}
+}
@@ -0,0 +1,45 @@
+// FlowMeter.h
+// Counts the pulses from a flow meter on a line of the Linux GPIO character device.  A thread of its own
+//  reads the kernel's timestamped edge events, so pulses at a few kHz aren't lost while the main loop is
+//  busy, and the main loop takes the count without a lock.  Pulses can also be fed in from elsewhere,
+//  e.g. the simulator's stand-in for a meter.
+//
+
+#ifndef _FLOWMETER_h
+#define _FLOWMETER_h
+
+#include <inttypes.h>
+#include <atomic>
+#include <thread>
+
+class FlowMeter
+{
+public:
+	FlowMeter();
+	~FlowMeter();
+	// Request the line from the chip and start counting its rising edges
+	bool Start(const char * chip, uint8_t line);
+	void Stop();
+	// Pulses from something other than a line
+	void Feed(uint32_t pulses);
+	// whether there's a meter at all, so that no water can be told from no meter
+	bool IsCounting() const { return m_bCounting; }
+	// pulses since starting, wrapping round
+	uint32_t Pulses() const { return m_pulses.load(std::memory_order_relaxed); }
+	// pulses a minute from the time between the last two, 0 once they've stopped coming
+	uint32_t Rate() const;
+private:
+	void Run();
+	int m_fd;
+	bool m_bCounting;
+	std::atomic<bool> m_bStop;
+	std::atomic<uint32_t> m_pulses;
+	// event timestamps, CLOCK_MONOTONIC in ns
+	std::atomic<uint64_t> m_lastNs;
+	std::atomic<uint64_t> m_periodNs;
+	std::thread m_thread;
+};
+
+extern FlowMeter flowMeter;
+
+#endif
@@ -0,0 +1,86 @@
+// Gpio.cpp
+// Direct outputs through the Linux GPIO character device.
+//
+
+#include "Gpio.h"
+#include "port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+GpioLines::GpioLines() : m_fd(-1), m_count(0)
+{
+}
+
+GpioLines::~GpioLines()
+{
+	Close();
+}
+
+bool GpioLines::Open(const char * chip, const uint8_t * lines, int count, bool bActiveLow)
+{
+	Close();
+	if ((count <= 0) || (count > GPIO_V2_LINES_MAX))
+		return false;
+	const int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0)
+	{
+		trace(F("Can't open %s (%s)\n"), chip, strerror(errno));
+		return false;
+	}
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	for (int i = 0; i < count; i++)
+		req.offsets[i] = lines[i];
+	strncpy(req.consumer, "sprinklers_pi", sizeof(req.consumer) - 1);
+	req.num_lines = count;
+	req.config.flags = GPIO_V2_LINE_FLAG_OUTPUT | (bActiveLow ? GPIO_V2_LINE_FLAG_ACTIVE_LOW : 0);
+	// start with them all off
+	req.config.num_attrs = 1;
+	req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+	req.config.attrs[0].attr.values = 0;
+	req.config.attrs[0].mask = (count == 64) ? ~0ULL : (1ULL << count) - 1;
+	const int ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(chip_fd);
+	if (ret < 0)
+	{
+		trace(F("Can't get the output lines from %s (%s)\n"), chip, strerror(errno));
+		return false;
+	}
+	m_fd = req.fd;
+	m_count = count;
+	return true;
+}
+
+void GpioLines::Close()
+{
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+	m_count = 0;
+}
+
+bool GpioLines::SetBits(uint64_t bits)
+{
+	if (m_fd < 0)
+		return false;
+	struct gpio_v2_line_values values;
+	values.bits = bits;
+	values.mask = (m_count == 64) ? ~0ULL : (1ULL << m_count) - 1;
+	if (ioctl(m_fd, GPIO_V2_LINE_SET_VALUES_IOCTL, &values) < 0)
+	{
+		trace(F("Failed to set the outputs (%s)\n"), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+uint8_t WiringPiToGpio(uint8_t pin)
+{
+	// Broadcom numbering of wiringPi pins 0-31 on a Pi with the 40 pin header
+	static const uint8_t map[] = {17, 18, 27, 22, 23, 24, 25, 4, 2, 3, 8, 7, 10, 9, 11, 14, 15, 28, 29, 30, 31, 5, 6, 13, 19, 26, 12, 16, 20, 21, 0, 1};
+	return (pin < sizeof(map)) ? map[pin] : pin;
+}
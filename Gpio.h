@@ -0,0 +1,31 @@
+// Gpio.h
+// Direct outputs through the Linux GPIO character device (/dev/gpiochipN).  All the zone lines are
+//  requested together once, and every change of the outputs is a single ioctl, so the valves switch
+//  together rather than one pin after another.
+//
+
+#ifndef _GPIO_h
+#define _GPIO_h
+
+#include <inttypes.h>
+
+class GpioLines
+{
+public:
+	GpioLines();
+	~GpioLines();
+	// Request the lines from the chip as outputs, all off.  With bActiveLow off is a high output.
+	bool Open(const char * chip, const uint8_t * lines, int count, bool bActiveLow);
+	void Close();
+	bool IsOpen() const { return m_fd >= 0; }
+	// Set all the lines at once, the i'th line from bit i
+	bool SetBits(uint64_t bits);
+private:
+	int m_fd;
+	int m_count;
+};
+
+// The GPIO line for a wiringPi pin number, as in the boards' pin maps (Boards.h)
+uint8_t WiringPiToGpio(uint8_t pin);
+
+#endif
@@ -0,0 +1,95 @@
+// Inputs.cpp
+// Digital inputs on lines of the Linux GPIO character device.
+//
+
+#include "Inputs.h"
+#include "port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+
+Inputs::Inputs() : m_count(0)
+{
+}
+
+Inputs::~Inputs()
+{
+	for (int i = 0; i < m_count; i++)
+		close(m_inputs[i].fd);
+}
+
+int Inputs::Add(const char * chip, uint8_t line, const char * name, bool bActiveLow, uint32_t debounce_us)
+{
+	if (m_count >= MAX_INPUTS)
+		return -1;
+	const int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0)
+	{
+		trace(F("Can't open %s (%s)\n"), chip, strerror(errno));
+		return -1;
+	}
+	struct gpio_v2_line_request req;
+	memset(&req, 0, sizeof(req));
+	req.offsets[0] = line;
+	strncpy(req.consumer, "sprinklers_pi", sizeof(req.consumer) - 1);
+	req.num_lines = 1;
+	// with the line active low a rising edge is the input going active
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING | GPIO_V2_LINE_FLAG_EDGE_FALLING
+			| (bActiveLow ? GPIO_V2_LINE_FLAG_ACTIVE_LOW : 0);
+	req.config.num_attrs = 1;
+	req.config.attrs[0].attr.id = GPIO_V2_LINE_ATTR_ID_DEBOUNCE;
+	req.config.attrs[0].attr.debounce_period_us = debounce_us;
+	req.config.attrs[0].mask = 1;
+	const int ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	close(chip_fd);
+	if (ret < 0)
+	{
+		trace(F("Can't get the %s input from %s (%s)\n"), name, chip, strerror(errno));
+		return -1;
+	}
+	Input & input = m_inputs[m_count];
+	input.fd = req.fd;
+	strncpy(input.name, name, sizeof(input.name) - 1);
+	input.name[sizeof(input.name) - 1] = 0;
+	struct gpio_v2_line_values values = {0, 1};
+	input.bActive = (ioctl(input.fd, GPIO_V2_LINE_GET_VALUES_IOCTL, &values) == 0) && (values.bits & 1);
+	fcntl(input.fd, F_SETFL, O_NONBLOCK);
+	trace(F("Input %s on line %d is %s\n"), input.name, line, input.bActive ? "active" : "inactive");
+	return m_count++;
+}
+
+bool Inputs::Wait(int timeout_ms)
+{
+	struct pollfd fds[MAX_INPUTS];
+	for (int i = 0; i < m_count; i++)
+	{
+		fds[i].fd = m_inputs[i].fd;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	if (poll(fds, m_count, timeout_ms) <= 0)
+		return false;
+	bool bChanged = false;
+	for (int i = 0; i < m_count; i++)
+	{
+		if (!(fds[i].revents & POLLIN))
+			continue;
+		Input & input = m_inputs[i];
+		const bool bWasActive = input.bActive;
+		// the last edge says where it's ended up
+		struct gpio_v2_line_event event[16];
+		ssize_t len;
+		while ((len = read(input.fd, event, sizeof(event))) >= (ssize_t) sizeof(event[0]))
+			input.bActive = (event[len / sizeof(event[0]) - 1].id == GPIO_V2_LINE_EVENT_RISING_EDGE);
+		if (input.bActive != bWasActive)
+		{
+			trace(F("Input %s is %s\n"), input.name, input.bActive ? "active" : "inactive");
+			bChanged = true;
+		}
+	}
+	return bChanged;
+}
@@ -0,0 +1,37 @@
+// Inputs.h
+// Digital inputs on lines of the Linux GPIO character device, e.g. a rain sensor or a flow switch.  The
+//  kernel debounces each line and reports its edges, so nothing polls the pins: the main loop waits on
+//  the lines in place of its sleep and picks up an edge as soon as it comes.
+//
+
+#ifndef _INPUTS_h
+#define _INPUTS_h
+
+#include <inttypes.h>
+
+#define MAX_INPUTS 8
+
+class Inputs
+{
+public:
+	Inputs();
+	~Inputs();
+	// Request a line from the chip.  Returns the input's number, or -1 if it can't be had.
+	int Add(const char * chip, uint8_t line, const char * name, bool bActiveLow, uint32_t debounce_us);
+	int Count() const { return m_count; }
+	bool IsActive(int input) const { return (input >= 0) && (input < m_count) && m_inputs[input].bActive; }
+	// Wait up to timeout_ms for an edge on any input, and take in any that have come.  Returns true if an
+	//  input changed.
+	bool Wait(int timeout_ms);
+private:
+	struct Input
+	{
+		int fd;
+		char name[16];
+		bool bActive;
+	};
+	Input m_inputs[MAX_INPUTS];
+	int m_count;
+};
+
+#endif
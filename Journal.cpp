@@ -0,0 +1,102 @@
+// Journal.cpp
+// Keeps a small journal of the schedule run in progress.
+//
+
+#include "Journal.h"
+#include "port.h"
+#include <string.h>
+#include <unistd.h>
+
+Journal::Journal(const char * dir)
+		: m_file(0), m_bDirty(false)
+{
+#ifdef SIMULATOR
+	// the simulator runs from the daemon's directory, and mustn't touch the daemon's journal
+	m_path[0] = 0;
+#else
+	if (snprintf(m_path, sizeof(m_path), "%sjournal", dir) >= (int) sizeof(m_path))
+	{
+		trace(F("Journal directory %s is too long, not journalling\n"), dir);
+		m_path[0] = 0;
+	}
+#endif
+}
+
+Journal::~Journal()
+{
+	if (m_file)
+		fclose(m_file);
+}
+
+void Journal::Append(const JournalRecord & record)
+{
+	if (!m_path[0])
+		return;
+	if (!m_file)
+	{
+		m_file = fopen(m_path, "ab");
+		if (!m_file)
+			return trace(F("Failed to open journal file\n"));
+	}
+	fwrite(&record, sizeof(record), 1, m_file);
+	m_bDirty = true;
+}
+
+void Journal::RunStarted(uint8_t sched, int16_t seasonal, int16_t weather, long day)
+{
+	if (!m_path[0])
+		return;
+	if (m_file)
+		fclose(m_file);
+	m_file = fopen(m_path, "wb");
+	if (!m_file)
+		return trace(F("Failed to open journal file\n"));
+
+	JournalRecord record = {0};
+	record.type = JournalRecord::START;
+	record.data = sched;
+	record.seasonal = seasonal;
+	record.weather = weather;
+	record.time = day;
+	Append(record);
+}
+
+void Journal::EventQueued(uint8_t command, uint8_t zone, long time, long end)
+{
+	JournalRecord record = {0};
+	record.type = JournalRecord::EVENT;
+	record.command = command;
+	record.data = zone;
+	record.time = time;
+	record.end = end;
+	Append(record);
+}
+
+void Journal::RunEnded()
+{
+	JournalRecord record = {0};
+	record.type = JournalRecord::END;
+	Append(record);
+}
+
+void Journal::Sync()
+{
+	if (!m_bDirty)
+		return;
+	m_bDirty = false;
+	fflush(m_file);
+	fsync(fileno(m_file));
+}
+
+int Journal::Read(JournalRecord * records, int max_records)
+{
+	if (!m_path[0])
+		return 0;
+	FILE * fd = fopen(m_path, "rb");
+	if (!fd)
+		return 0;
+	// a record cut short by a crash is just dropped
+	const int count = fread(records, sizeof(JournalRecord), max_records, fd);
+	fclose(fd);
+	return count;
+}
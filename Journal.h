@@ -0,0 +1,49 @@
+// Journal.h
+// Keeps a small journal of the schedule run in progress, so that a restart can pick the run up again
+//  instead of dropping the rest of it.  The journal is truncated when a run starts, so it only ever
+//  holds the current (or last) run.
+//
+
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "config.h"
+#include <inttypes.h>
+#include <stdio.h>
+
+struct JournalRecord
+{
+	enum TYPE {START = 1, EVENT, END};
+	uint8_t type;
+	uint8_t command;	// EVENT: the event command
+	uint8_t data;		// START: the schedule number.  EVENT: the zone number
+	uint8_t reserved;
+	int16_t seasonal;	// START: the duration adjustments the run was made with
+	int16_t weather;
+	int32_t time;		// START: the day (days since Jan 1 1970).  Otherwise seconds past midnight
+	int32_t end;		// EVENT: seconds past midnight a zone on event turns the zone off
+};
+
+class Journal
+{
+public:
+	// the journal file is kept in dir, "" for the working directory
+	Journal(const char * dir = "");
+	~Journal();
+	// Start a new run, throwing away the last one
+	void RunStarted(uint8_t sched, int16_t seasonal, int16_t weather, long day);
+	// One of the events queued up for the run
+	void EventQueued(uint8_t command, uint8_t zone, long time, long end);
+	void RunEnded();
+	// Get what was written out to the disk.  Records are written straight away but only synced once a pass.
+	void Sync();
+	// Read back the journal, returns the number of records
+	int Read(JournalRecord * records, int max_records);
+private:
+	void Append(const JournalRecord & record);
+	FILE * m_file;
+	bool m_bDirty;
+	char m_path[CONTROLLER_DIR_SIZE + sizeof("journal")];
+};
+
+#endif /* JOURNAL_H_ */
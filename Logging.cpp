@@ -49,8 +49,8 @@ static bool CreateSchema(sqlite3 * db)
 	char * zErrMsg = 0;
 	if (sqlite3_exec(db,
 			"DROP TABLE IF EXISTS versions; DROP TABLE IF EXISTS zonelog; CREATE TABLE versions (version INT);"
-			"INSERT INTO versions VALUES (2);CREATE TABLE zonelog(date INTEGER, zone INTEGER, duration INTEGER, schedule INTEGER,"
-			"seasonal INTEGER, wunderground INTEGER);",
+			"INSERT INTO versions VALUES (4);CREATE TABLE zonelog(date INTEGER, zone INTEGER, duration INTEGER, schedule INTEGER,"
+			"seasonal INTEGER, wunderground INTEGER, volume REAL, flow REAL);",
 			NULL, NULL, &zErrMsg) != SQLITE_OK)
 	{
 		trace("SQL Error (%s)\n", zErrMsg);
@@ -76,9 +76,48 @@ static bool UpdateV1toV2(sqlite3 * db)
 	return true;
 }
 
-bool Logging::Init()
+// Quick schedule runs were logged as schedule 100, which is a real schedule once there can be more than
+//  99 of them.  They are logged as 0 now.
+static bool UpdateV2toV3(sqlite3 * db)
 {
-	int rc = sqlite3_open("db.sql", &m_db);
+	char * zErrMsg = 0;
+	if (sqlite3_exec(db,
+			"begin;UPDATE zonelog SET schedule=0 WHERE schedule=100;INSERT INTO versions VALUES (3);commit;",
+			NULL, NULL, &zErrMsg) != SQLITE_OK)
+	{
+		trace("SQL Error (%s)\n", zErrMsg);
+		sqlite3_free(zErrMsg);
+		return false;
+	}
+	return true;
+}
+
+// The litres through the flow meter during the run and the average litres a minute, -1 where there was
+//  no meter.
+static bool UpdateV3toV4(sqlite3 * db)
+{
+	char * zErrMsg = 0;
+	if (sqlite3_exec(db,
+			"begin;ALTER TABLE zonelog ADD COLUMN volume REAL DEFAULT -1;ALTER TABLE zonelog ADD COLUMN flow REAL DEFAULT -1;"
+			"INSERT INTO versions VALUES (4);commit;",
+			NULL, NULL, &zErrMsg) != SQLITE_OK)
+	{
+		trace("SQL Error (%s)\n", zErrMsg);
+		sqlite3_free(zErrMsg);
+		return false;
+	}
+	return true;
+}
+
+bool Logging::Init(const char * dir)
+{
+	char path[CONTROLLER_DIR_SIZE + sizeof("db.sql")];
+	if (snprintf(path, sizeof(path), "%sdb.sql", dir) >= (int) sizeof(path))
+	{
+		trace("Database directory %s is too long\n", dir);
+		return false;
+	}
+	int rc = sqlite3_open(path, &m_db);
 	if (rc)
 	{
 		trace("Can't open Database (%s)\n", sqlite3_errmsg(m_db));
@@ -90,8 +129,18 @@ bool Logging::Init()
 	if (version == 0)
 		CreateSchema(m_db);
 	else if (version == 1)
-		UpdateV1toV2(m_db);
-	else if (version != 2)
+	{
+		if (UpdateV1toV2(m_db) && UpdateV2toV3(m_db))
+			UpdateV3toV4(m_db);
+	}
+	else if (version == 2)
+	{
+		if (UpdateV2toV3(m_db))
+			UpdateV3toV4(m_db);
+	}
+	else if (version == 3)
+		UpdateV3toV4(m_db);
+	else if (version != 4)
 		CreateSchema(m_db);
 
 	return true;
@@ -106,11 +155,13 @@ void Logging::Close()
 	}
 }
 
-bool Logging::LogZoneEvent(time_t start, int zone, int duration, int schedule, int sadj, int wunderground)
+bool Logging::LogZoneEvent(time_t start, int zone, int duration, int schedule, int sadj, int wunderground, float volume)
 {
 	char * zErrMsg = 0;
-	char sSQL[100];
-	snprintf(sSQL, sizeof(sSQL), "INSERT INTO zonelog VALUES(%ld, %d, %d, %d, %d, %d);", start, zone, duration, schedule, sadj, wunderground);
+	char sSQL[140];
+	const float flow = ((volume >= 0) && (duration > 0)) ? volume * 60 / duration : -1;
+	snprintf(sSQL, sizeof(sSQL), "INSERT INTO zonelog VALUES(%ld, %d, %d, %d, %d, %d, %.2f, %.2f);", start, zone, duration, schedule, sadj,
+			wunderground, volume, flow);
 	sSQL[sizeof(sSQL) - 1] = 0;
 	if (sqlite3_exec(m_db, sSQL, NULL, NULL, &zErrMsg) != SQLITE_OK)
 	{
@@ -229,7 +280,7 @@ bool Logging::TableZone(FILE* stream_file, time_t start, time_t end)
 	end = spi_max(start,end) + 24*3600;  // add 1 day to end time.
 	char sSQL[200];
 	snprintf(sSQL, sizeof(sSQL),
-			"SELECT zone, date, duration, schedule, seasonal, wunderground"
+			"SELECT zone, date, duration, schedule, seasonal, wunderground, volume, flow"
 			" FROM zonelog WHERE date BETWEEN %lu AND %lu"
 			" ORDER BY zone,date",
 			start, end);
@@ -255,10 +306,11 @@ bool Logging::TableZone(FILE* stream_file, time_t start, time_t end)
 			current_zone = zone;
 			bFirstRow = true;
 		}
-		fprintf(stream_file, "%s\n\t\t\t\t{ \"date\":%ld, \"duration\":%d, \"schedule\":%d, \"seasonal\":%d, \"wunderground\":%d}",
+		fprintf(stream_file, "%s\n\t\t\t\t{ \"date\":%ld, \"duration\":%d, \"schedule\":%d, \"seasonal\":%d, \"wunderground\":%d, \"volume\":%.1f, \"flow\":%.2f}",
 				bFirstRow ? "":",",
 				(long)sqlite3_column_int(statement, 1), sqlite3_column_int(statement, 2), sqlite3_column_int(statement, 3),
-				sqlite3_column_int(statement, 4), sqlite3_column_int(statement, 5));
+				sqlite3_column_int(statement, 4), sqlite3_column_int(statement, 5), sqlite3_column_double(statement, 6),
+				sqlite3_column_double(statement, 7));
 		bFirstRow = false;
 	}
 	if (current_zone!=-1)
@@ -17,10 +17,11 @@ public:
 	enum GROUPING {NONE, HOURLY, DAILY, MONTHLY};
 	Logging();
 	~Logging();
-	bool Init();
+	// the database is kept in dir, "" for the working directory
+	bool Init(const char * dir = "");
 	void Close();
-	// Log an actual row to the database
-	bool LogZoneEvent(time_t start, int zone, int duration, int schedule, int sadj, int wunderground);
+	// Log an actual row to the database.  volume is the litres through the flow meter, -1 without one.
+	bool LogZoneEvent(time_t start, int zone, int duration, int schedule, int sadj, int wunderground, float volume);
 	// Retrieve data sutible for graphing
 	bool GraphZone(FILE * stream_file, time_t start, time_t end, GROUPING group);
 	// Retrieve data suitble for putting into a table
@@ -0,0 +1,255 @@
+// Output.cpp
+// The ways the outputs can be driven.
+//
+
+#include "Output.h"
+#include "Boards.h"
+#include "port.h"
+#include <stdlib.h>
+#ifndef ARDUINO
+#include "Coprocess.h"
+#include "Gpio.h"
+#include "ShiftRegister.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+// pins driven one at a time with digitalWrite, from wiringPi or the Arduino
+#if defined(ARDUINO) || (!defined(SIMULATOR) && !defined(NO_WIRINGPI))
+#define PIN_IO
+#ifndef ARDUINO
+#include <wiringPi.h>
+#endif
+#endif
+
+constexpr uint8_t PiBoard::pins[];
+constexpr uint8_t GreenIQBoard::pins[];
+constexpr uint8_t ArduinoBoard::pins[];
+
+#if defined(PIN_IO) && !defined(ARDUINO)
+// wiringPi needs root
+static bool PinSetup()
+{
+	if (geteuid() != 0)
+	{
+		trace("You need to be root to run this.\n");
+		return false;
+	}
+	return wiringPiSetup() != -1;
+}
+#elif defined(PIN_IO)
+static bool PinSetup()
+{
+	return true;
+}
+#endif
+
+// Nothing to drive
+class NoOutput : public Output
+{
+public:
+	bool Setup() { return true; }
+	void Latch(const ZoneSet &) {}
+};
+
+// Runs EXTERNAL_SCRIPT once for every output, if it's there
+class ScriptOutput : public Output
+{
+public:
+	ScriptOutput(int controller_id) : m_controller(controller_id) {}
+	bool Setup() { return true; }
+	void Latch(const ZoneSet & state)
+	{
+#if !defined(ARDUINO) && defined(EXTERNAL_SCRIPT)
+		struct stat buffer;
+		char cmd[50];
+		if (stat(EXTERNAL_SCRIPT, &buffer) != 0)
+			return;
+		for (int i = 0; i <= NUM_ZONES; i++)
+		{
+			// controllers after the first add their number
+			if (m_controller == 0)
+				sprintf(cmd, "%s %i %i", EXTERNAL_SCRIPT, i, state.Test(i)?1:0);
+			else
+				sprintf(cmd, "%s %i %i %i", EXTERNAL_SCRIPT, i, state.Test(i)?1:0, m_controller);
+			system(cmd);
+		}
+#endif
+	}
+private:
+	int m_controller;
+};
+
+#ifdef PIN_IO
+// Sets the pins of board B to the outputs, high for on or, if bNegative, low.  The board's known when it's
+//  compiled, so this is a loop over a constant number of constant pins.
+template <class B, bool bNegative>
+static void LatchPins(const ZoneSet & state)
+{
+	for (int i = 0; i < DirectOutputs<B>(); i++)
+		digitalWrite(B::pins[i], state.Test(i) != bNegative);
+}
+#endif
+
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+// The outputs of board B as the values of its lines, bit i for line i.  Like LatchPins this is a loop over
+//  a constant number of lines; negative boards have them active low, so nothing's inverted here.
+template <class B>
+static uint64_t LineBits(const ZoneSet & state)
+{
+	uint64_t bits = 0;
+	for (int i = 0; i < DirectOutputs<B>(); i++)
+		bits |= (uint64_t) state.Test(i) << i;
+	return bits;
+}
+#endif
+
+// A relay on a pin of board B for each output, on when the pin's high or, if bNegative, low
+template <class B, bool bNegative>
+class DirectOutput : public Output
+{
+public:
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+	DirectOutput(const char * chip = GPIO_CHIP) : m_chip(chip) {}
+#endif
+	bool Setup()
+	{
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+		// the character device needs no wiringPi, nor root if the chip can be opened.  If it can't, e.g. the
+		//  kernel's older than 5.10, the pins are driven through wiringPi.
+		uint8_t lines[DirectOutputs<B>()];
+		for (int i = 0; i < DirectOutputs<B>(); i++)
+			lines[i] = WiringPiToGpio(B::pins[i]);
+		if (m_lines.Open(m_chip, lines, DirectOutputs<B>(), bNegative))
+			return true;
+#endif
+#ifdef PIN_IO
+		if (!PinSetup())
+			return false;
+		for (uint8_t i = 0; i < sizeof(B::pins); i++)
+		{
+			pinMode(B::pins[i], OUTPUT);
+			digitalWrite(B::pins[i], bNegative);
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+	void Latch(const ZoneSet & state)
+	{
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+		if (m_lines.IsOpen())
+		{
+			// all the valves switch together
+			m_lines.SetBits(LineBits<B>(state));
+			return;
+		}
+#endif
+#ifdef PIN_IO
+		LatchPins<B, bNegative>(state);
+#endif
+	}
+private:
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+	const char * m_chip;
+	GpioLines m_lines;
+#endif
+};
+
+#ifndef ARDUINO
+// The OpenSprinkler shift register on board B
+template <class B>
+class ShiftRegisterOutput : public Output
+{
+public:
+	bool Setup()
+	{
+#if defined(GPIO_CHIP) && defined(SR_SPI_DEVICE)
+		// if the SPI device can't be had the pins are bit-banged
+		if (m_register.Open(SR_SPI_DEVICE, GPIO_CHIP, WiringPiToGpio(B::srLatch), WiringPiToGpio(B::srEnable), SR_SPI_SPEED))
+			return true;
+#endif
+#ifdef PIN_IO
+		return PinSetup() && m_register.OpenPins(B::srClock, B::srData, B::srLatch, B::srEnable);
+#else
+		return false;
+#endif
+	}
+	void Latch(const ZoneSet & state)
+	{
+		m_register.Shift(state);
+	}
+private:
+	ShiftRegister m_register;
+};
+#endif
+
+// The OpenSprinkler output for board B, or nothing if it hasn't the shift register
+template <class B, bool bShiftRegister = B::bShiftRegister>
+struct OpenSprinklerOutput
+{
+#ifndef ARDUINO
+	static Output * New() { return new ShiftRegisterOutput<B>; }
+#else
+	static Output * New() { return new NoOutput; }
+#endif
+};
+
+template <class B>
+struct OpenSprinklerOutput<B, false>
+{
+	static Output * New() { return new NoOutput; }
+};
+
+void SimulatedOutput::Latch(const ZoneSet & state)
+{
+	Transition & t = m_transitions[m_latches++ % KEPT];
+	t.time = now();
+	t.state = state;
+}
+
+const SimulatedOutput::Transition * SimulatedOutput::GetTransition(uint32_t n) const
+{
+	if ((n >= m_latches) || (m_latches - n > KEPT))
+		return 0;
+	return &m_transitions[n % KEPT];
+}
+
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+Output * NewDirectOutput(const char * chip, bool bNegative)
+{
+	if (bNegative)
+		return new DirectOutput<Board, true>(chip);
+	return new DirectOutput<Board, false>(chip);
+}
+#endif
+
+Output * NewOutput(EOT eot, int controller_id)
+{
+#ifdef SIMULATOR
+	// no hardware to drive, whatever the output type
+	return new SimulatedOutput;
+#else
+	switch (eot)
+	{
+	case OT_NONE:
+		return new ScriptOutput(controller_id);
+	case OT_DIRECT_POS:
+		return new DirectOutput<Board, false>;
+	case OT_DIRECT_NEG:
+		return new DirectOutput<Board, true>;
+	case OT_OPEN_SPRINKLER:
+		return OpenSprinklerOutput<Board>::New();
+#ifndef ARDUINO
+	case OT_COPROCESS:
+		return new Coprocess(COPROCESS_SCRIPT, controller_id);
+#endif
+	case OT_SIMULATED:
+		return new SimulatedOutput;
+	default:
+		return new NoOutput;
+	}
+#endif
+}
@@ -0,0 +1,57 @@
+// Output.h
+// The ways the outputs can be driven, one for each output type.  The controller sets up the one for the
+//  output type chosen, and latches the whole set of outputs on it each time they change.
+//
+
+#ifndef _OUTPUT_h
+#define _OUTPUT_h
+
+#include <inttypes.h>
+#include <time.h>
+#include "ZoneSet.h"
+#include "settings.h"
+
+class Output
+{
+public:
+	virtual ~Output() {}
+	// Get the outputs ready, all off.  Returns false if they can't be driven this way.
+	virtual bool Setup() = 0;
+	// Set the outputs, bit 0 the pump and bit n zone n
+	virtual void Latch(const ZoneSet & state) = 0;
+	// Called each time round the main loop
+	virtual void Poll() {}
+};
+
+// The output for an output type, for the controller with this id
+Output * NewOutput(EOT eot, int controller_id);
+#if !defined(ARDUINO) && defined(GPIO_CHIP)
+// The Direct Positive or, if bNegative, Direct Negative output on the lines of another chip than GPIO_CHIP
+Output * NewDirectOutput(const char * chip, bool bNegative);
+#endif
+
+// Stands in for the hardware, keeping the last few changes of the outputs and when they were made.  It's
+//  what the simulator runs, and the Simulated output type on a build without any hardware.
+class SimulatedOutput : public Output
+{
+public:
+	struct Transition
+	{
+		time_t time;
+		ZoneSet state;
+	};
+	// changes kept
+	enum {KEPT = 16};
+	SimulatedOutput() : m_latches(0) {}
+	bool Setup() { return true; }
+	void Latch(const ZoneSet & state);
+	// times the outputs have been latched
+	uint32_t Latches() const { return m_latches; }
+	// the n'th latch, counting from 0, or 0 if it's no longer kept
+	const Transition * GetTransition(uint32_t n) const;
+private:
+	Transition m_transitions[KEPT];
+	uint32_t m_latches;
+};
+
+#endif
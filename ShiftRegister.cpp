@@ -0,0 +1,174 @@
+// ShiftRegister.cpp
+// The OpenSprinkler shift register.
+//
+
+#include "ShiftRegister.h"
+#include "port.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/spi/spidev.h>
+// the pins are bit-banged through wiringPi
+#if !defined(SIMULATOR) && !defined(NO_WIRINGPI)
+#define PIN_IO
+#include <wiringPi.h>
+#endif
+
+enum {PIN_CLOCK, PIN_DATA, PIN_LATCH, PIN_ENABLE};
+
+ShiftRegister::ShiftRegister() : m_mode(SR_CLOSED), m_fd(-1), m_speed(0), m_bLatched(false), m_shifts(0)
+{
+}
+
+ShiftRegister::~ShiftRegister()
+{
+	Close();
+}
+
+bool ShiftRegister::Open(const char * device, const char * chip, uint8_t latchLine, uint8_t enableLine, uint32_t speed)
+{
+	Close();
+	m_fd = open(device, O_RDWR | O_CLOEXEC);
+	if (m_fd < 0)
+	{
+		trace(F("Can't open %s (%s)\n"), device, strerror(errno));
+		return false;
+	}
+	// only a plain file stands in for the register.  Any other device that won't take the SPI mode is an
+	//  error, so the pins are bit-banged instead.
+	struct stat st;
+	if ((fstat(m_fd, &st) == 0) && S_ISREG(st.st_mode))
+	{
+		m_mode = SR_FILE;
+		return true;
+	}
+	// the 74HC595 takes its data on the rising edge of the clock, most significant bit first
+	uint8_t mode = SPI_MODE_0;
+	m_speed = speed;
+	const uint8_t lines[] = {latchLine, enableLine};
+	// outputs off until the first latch, whatever the registers powered up with
+	if ((ioctl(m_fd, SPI_IOC_WR_MODE, &mode) < 0) || (ioctl(m_fd, SPI_IOC_WR_MAX_SPEED_HZ, &m_speed) < 0)
+			|| !m_lines.Open(chip, lines, 2, false) || !m_lines.SetBits(2))
+	{
+		trace(F("Can't set up %s (%s)\n"), device, strerror(errno));
+		Close();
+		return false;
+	}
+	m_mode = SR_SPI;
+	return true;
+}
+
+bool ShiftRegister::OpenPins(uint8_t clock, uint8_t data, uint8_t latch, uint8_t enable)
+{
+	Close();
+#ifndef PIN_IO
+	return false;
+#else
+	m_pins[PIN_CLOCK] = clock;
+	m_pins[PIN_DATA] = data;
+	m_pins[PIN_LATCH] = latch;
+	m_pins[PIN_ENABLE] = enable;
+	// outputs off until the first latch, whatever the registers powered up with
+	for (int i = 0; i < 4; i++)
+	{
+		pinMode(m_pins[i], OUTPUT);
+		digitalWrite(m_pins[i], i == PIN_ENABLE);
+	}
+	m_mode = SR_PINS;
+	return true;
+#endif
+}
+
+void ShiftRegister::Close()
+{
+	// turn the outputs off on the way out
+	if (m_mode == SR_SPI)
+		m_lines.SetBits(2);
+#ifdef PIN_IO
+	if (m_mode == SR_PINS)
+		digitalWrite(m_pins[PIN_ENABLE], 1);
+#endif
+	m_lines.Close();
+	if (m_fd >= 0)
+		close(m_fd);
+	m_fd = -1;
+	m_mode = SR_CLOSED;
+	m_bLatched = false;
+}
+
+bool ShiftRegister::Shift(const ZoneSet & state)
+{
+	if (m_mode == SR_CLOSED)
+		return false;
+	for (int i = 0; i < SR_REGISTERS; i++)
+	{
+		uint8_t byte = 0;
+		for (int bit = 7; bit >= 0; bit--)
+		{
+			const int output = (SR_REGISTERS - 1 - i) * 8 + bit;
+			byte = (byte << 1) | ((output <= NUM_ZONES) && state.Test(output));
+		}
+		m_back[i] = byte;
+	}
+	if (m_bLatched && (memcmp(m_front, m_back, sizeof(m_front)) == 0))
+		return true;
+	if (!Write())
+		return false;
+	memcpy(m_front, m_back, sizeof(m_front));
+	m_bLatched = true;
+	m_shifts++;
+	return true;
+}
+
+bool ShiftRegister::Write()
+{
+	switch (m_mode)
+	{
+	case SR_FILE:
+		return pwrite(m_fd, m_back, sizeof(m_back), 0) == (ssize_t) sizeof(m_back);
+
+	case SR_SPI:
+	{
+		// the outputs hold what's latched while the next ones are shifted in, so they're left on
+		struct spi_ioc_transfer xfer;
+		memset(&xfer, 0, sizeof(xfer));
+		xfer.tx_buf = (uintptr_t) m_back;
+		xfer.len = sizeof(m_back);
+		xfer.speed_hz = m_speed;
+		xfer.bits_per_word = 8;
+		const bool bSent = ioctl(m_fd, SPI_IOC_MESSAGE(1), &xfer) >= 0;
+		if (!bSent)
+			trace(F("Failed to shift out the outputs (%s)\n"), strerror(errno));
+		// latch on the rising edge, unless what's there is only half shifted, and turn the outputs on once
+		//  something has been
+		const bool bLatched = bSent && m_lines.SetBits(m_bLatched ? 1 : 3);
+		return m_lines.SetBits((bLatched || m_bLatched) ? 0 : 2) && bLatched;
+	}
+
+	case SR_PINS:
+#ifdef PIN_IO
+		// the outputs hold what's latched while the next ones are shifted in
+		digitalWrite(m_pins[PIN_LATCH], 0);
+		for (int i = 0; i < SR_REGISTERS; i++)
+		{
+			for (int bit = 7; bit >= 0; bit--)
+			{
+				digitalWrite(m_pins[PIN_CLOCK], 0);
+				digitalWrite(m_pins[PIN_DATA], (m_back[i] >> bit) & 1);
+				digitalWrite(m_pins[PIN_CLOCK], 1);
+			}
+		}
+		// latch the outputs, turning them on the first time
+		digitalWrite(m_pins[PIN_LATCH], 1);
+		if (!m_bLatched)
+			digitalWrite(m_pins[PIN_ENABLE], 0);
+		return true;
+#endif
+
+	default:
+		return false;
+	}
+}
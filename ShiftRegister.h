@@ -0,0 +1,52 @@
+// ShiftRegister.h
+// The OpenSprinkler shift register, a chain of SR_REGISTERS 74HC595s.  The outputs are kept as a
+//  front image, what's latched, and a back image, what's wanted, and only shifted out when the two
+//  differ.  The 74HC595 only changes its outputs when it's latched, so they carry on as they are while
+//  the next ones are shifted in, the pump included.  The NOT enable pin only holds them off from opening
+//  to the first latch, whatever the registers powered up with, and again on closing.
+//
+// It's driven through SPI (/dev/spidevX.Y), the whole image going out in one transfer and then being
+//  latched with a GPIO line, or by clocking each bit out on wiringPi pins.  Given a plain file instead
+//  of the SPI device, the image is written to the start of it, and there's nothing to latch, which
+//  stands in for the hardware when testing.
+//
+
+#ifndef _SHIFTREGISTER_h
+#define _SHIFTREGISTER_h
+
+#include <inttypes.h>
+#include "ZoneSet.h"
+#include "Gpio.h"
+
+class ShiftRegister
+{
+public:
+	ShiftRegister();
+	~ShiftRegister();
+	// Open the SPI device, taking the latch and NOT enable lines from the GPIO chip
+	bool Open(const char * device, const char * chip, uint8_t latchLine, uint8_t enableLine, uint32_t speed);
+	// Bit-bang the register on these wiringPi pins
+	bool OpenPins(uint8_t clock, uint8_t data, uint8_t latch, uint8_t enable);
+	void Close();
+	bool IsOpen() const { return m_mode != SR_CLOSED; }
+	// Shift out the outputs, the last output first, and latch them if they've changed
+	bool Shift(const ZoneSet & state);
+	// times the outputs have been shifted out
+	uint32_t Shifts() const { return m_shifts; }
+private:
+	enum {SR_CLOSED, SR_FILE, SR_SPI, SR_PINS} m_mode;
+	bool Write();
+	int m_fd;
+	uint32_t m_speed;
+	// the latch, line 0, and the NOT enable, line 1
+	GpioLines m_lines;
+	uint8_t m_pins[4];
+	// the first byte goes out first and ends up furthest along the chain, so holds the last outputs
+	uint8_t m_front[SR_REGISTERS];
+	uint8_t m_back[SR_REGISTERS];
+	// whether m_front is what's latched, it isn't until the first shift
+	bool m_bLatched;
+	uint32_t m_shifts;
+};
+
+#endif
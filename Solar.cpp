@@ -0,0 +1,85 @@
+// Solar.cpp
+// Sunrise and sunset times for the configured location.
+//
+
+#include "Solar.h"
+#include "settings.h"
+#include "Controller.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DEG_TO_RAD (M_PI / 180.0)
+
+SolarTable::SolarTable()
+		: m_bValid(false), m_firstDay(0)
+{
+	m_location[0] = 0;
+}
+
+// The sunrise equation (https://en.wikipedia.org/wiki/Sunrise_equation), good to a minute or two.
+//  Times are minutes past UTC midnight of the day, SOLAR_NONE when the sun doesn't rise or set.
+static void SunTimes(long day, double lat, double lon, int16_t * pSunrise, int16_t * pSunset)
+{
+	const double jd_midnight = day + 2440587.5;
+	const double n = ceil(jd_midnight - 2451545.0 + 0.0008);
+	const double mean_noon = n - lon / 360.0;
+	const double m = fmod(357.5291 + 0.98560028 * mean_noon, 360.0) * DEG_TO_RAD;
+	const double c = 1.9148 * sin(m) + 0.0200 * sin(2 * m) + 0.0003 * sin(3 * m);
+	const double lambda = fmod(m / DEG_TO_RAD + c + 180.0 + 102.9372, 360.0) * DEG_TO_RAD;
+	const double transit = 2451545.0 + mean_noon + 0.0053 * sin(m) - 0.0069 * sin(2 * lambda);
+	const double sin_dec = sin(lambda) * sin(23.4397 * DEG_TO_RAD);
+	const double cos_dec = cos(asin(sin_dec));
+	const double cos_hour = (sin(-0.833 * DEG_TO_RAD) - sin(lat * DEG_TO_RAD) * sin_dec) / (cos(lat * DEG_TO_RAD) * cos_dec);
+	if ((cos_hour > 1.0) || (cos_hour < -1.0))
+	{
+		*pSunrise = SOLAR_NONE;
+		*pSunset = SOLAR_NONE;
+		return;
+	}
+	const double hour_angle = acos(cos_hour) / DEG_TO_RAD;
+	*pSunrise = (int16_t) floor((transit - hour_angle / 360.0 - jd_midnight) * 1440.0 + 0.5);
+	*pSunset = (int16_t) floor((transit + hour_angle / 360.0 - jd_midnight) * 1440.0 + 0.5);
+}
+
+bool SolarTable::Build(const char * location, long first_day)
+{
+	strncpy(m_location, location, sizeof(m_location) - 1);
+	m_location[sizeof(m_location) - 1] = 0;
+	m_firstDay = first_day;
+	double lat, lon;
+	m_bValid = (sscanf(location, "%lf , %lf", &lat, &lon) == 2) && (fabs(lat) <= 90.0) && (fabs(lon) <= 180.0);
+	if (!m_bValid)
+	{
+		trace(F("Location '%s' isn't a latitude,longitude, no sunrise or sunset times\n"), location);
+		return false;
+	}
+	for (int i = 0; i < SOLAR_DAYS; i++)
+		SunTimes(first_day + i, lat, lon, &m_sunrise[i], &m_sunset[i]);
+	return true;
+}
+
+bool SolarTable::Get(long day, int16_t * pSunrise, int16_t * pSunset)
+{
+	char location[LEN_LOC + 1];
+	GetLoc(location);
+	if ((strcmp(location, m_location) != 0) || (day < m_firstDay) || (day >= m_firstDay + SOLAR_DAYS))
+		Build(location, day);
+	if (!m_bValid)
+		return false;
+	*pSunrise = m_sunrise[day - m_firstDay];
+	*pSunset = m_sunset[day - m_firstDay];
+	return (*pSunrise != SOLAR_NONE);
+}
+
+short StartMinute(short time, long day, long offset)
+{
+	if ((time == -1) || !(time & (TIME_SUNRISE | TIME_SUNSET)))
+		return time;
+
+	int16_t sunrise, sunset;
+	if (!controller->m_solarTable.Get(day, &sunrise, &sunset))
+		return -1;
+	const long minute = ((time & TIME_SUNRISE) ? sunrise : sunset) + offset / 60 + TimeOffset(time);
+	return (short) spi_max(0L, spi_min(minute, 24 * 60L - 1));
+}
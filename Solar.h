@@ -0,0 +1,36 @@
+// Solar.h
+// Sunrise and sunset times for the configured location, so schedules can start relative to them.
+//  A year of times is worked out at once and kept, so looking up a start time is just a table read.
+//
+
+#ifndef _SOLAR_h
+#define _SOLAR_h
+
+#include <inttypes.h>
+#include "port.h"
+#include "settings.h"
+
+#define SOLAR_DAYS 366
+#define SOLAR_NONE INT16_MIN
+
+class SolarTable
+{
+public:
+	SolarTable();
+	// Sunrise and sunset on a day (days since Jan 1 1970), in minutes past UTC midnight.
+	//  Returns false if the location isn't set, or the sun doesn't rise or set that day.
+	bool Get(long day, int16_t * pSunrise, int16_t * pSunset);
+private:
+	bool Build(const char * location, long first_day);
+	char m_location[LEN_LOC + 1];
+	bool m_bValid;
+	long m_firstDay;
+	int16_t m_sunrise[SOLAR_DAYS];
+	int16_t m_sunset[SOLAR_DAYS];
+};
+
+// The minute of the local day a schedule start time falls on, or -1 if it doesn't have one.
+//  day is the local day and offset the seconds local time is ahead of UTC.
+short StartMinute(short time, long day, long offset);
+
+#endif
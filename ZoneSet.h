@@ -0,0 +1,53 @@
+// ZoneSet.h
+// The on/off state of the outputs, one bit per zone with bit 0 the pump.  It's sized at compile time
+//  from NUM_ZONES, so a build isn't held to the 15 zones that fit in a uint16_t.
+//
+
+#ifndef _ZONESET_h
+#define _ZONESET_h
+
+#include <inttypes.h>
+#include <string.h>
+#include "config.h"
+
+#define ZONE_SET_WORDS ((NUM_ZONES + 1 + 31) / 32)
+
+class ZoneSet
+{
+public:
+	ZoneSet() { Clear(); }
+	void Clear() { memset(m_words, 0, sizeof(m_words)); }
+	bool Test(int bit) const { return m_words[bit >> 5] & ((uint32_t) 1 << (bit & 31)); }
+	void Set(int bit) { m_words[bit >> 5] |= (uint32_t) 1 << (bit & 31); }
+	void Reset(int bit) { m_words[bit >> 5] &= ~((uint32_t) 1 << (bit & 31)); }
+	void Set(int bit, bool val) { if (val) Set(bit); else Reset(bit); }
+	// The first bit set after bit, or -1 if there isn't one.  Next(-1) is the first bit set.
+	int Next(int bit) const
+	{
+		int word = (bit + 1) >> 5;
+		if (word >= ZONE_SET_WORDS)
+			return -1;
+		uint32_t bits = m_words[word] & ~(((uint32_t) 1 << ((bit + 1) & 31)) - 1);
+		while (!bits)
+		{
+			if (++word >= ZONE_SET_WORDS)
+				return -1;
+			bits = m_words[word];
+		}
+		return (word << 5) + __builtin_ctz(bits);
+	}
+	// The bits that are different in the two sets
+	ZoneSet operator^(const ZoneSet & other) const
+	{
+		ZoneSet result;
+		for (int i = 0; i < ZONE_SET_WORDS; i++)
+			result.m_words[i] = m_words[i] ^ other.m_words[i];
+		return result;
+	}
+	bool operator==(const ZoneSet & other) const { return memcmp(m_words, other.m_words, sizeof(m_words)) == 0; }
+	bool operator!=(const ZoneSet & other) const { return !(*this == other); }
+private:
+	uint32_t m_words[ZONE_SET_WORDS];
+};
+
+#endif
@@ -11,15 +11,36 @@
 // Uncomment to use GreenIQ V2 board
 //#define GREENIQ 1
 
-// max number of schedules you will be allowed to create
+// max number of schedules you will be allowed to create, up to 254.  The settings file grows to fit them.
+#ifndef MAX_SCHEDULES
 #define MAX_SCHEDULES 10
+#endif
+// maximum number of zones allowed, up to 128.  Past 15 the zones and schedules take up more room in
+//  the settings file, and are moved there the first time it's run.
+#ifndef NUM_ZONES
 #ifdef GREENIQ
-// maximum number of zones allowed
 #define NUM_ZONES 6
 #else
-// maximum number of zones allowed
 #define NUM_ZONES 15
 #endif
+#endif
+
+// number of 74HC595s chained on the OpenSprinkler shift register, 8 outputs each.  The OpenSprinkler
+//  has 2, expansion boards add to the chain.  By default there are enough for the pump and every zone.
+#ifndef SR_REGISTERS
+#define SR_REGISTERS ((NUM_ZONES + 8) / 8 < 2 ? 2 : (NUM_ZONES + 8) / 8)
+#endif
+
+// most controllers one process can run, each with its own settings, schedules and zones
+#ifndef MAX_CONTROLLERS
+#define MAX_CONTROLLERS 16
+#endif
+// room for the directory a controller keeps its files in, "c1/" and on, with its 0.  The paths of its
+//  files are sized from this and the file's name.
+#define CONTROLLER_DIR_SIZE 16
+
+// Most cycles a zone's run will be split into for cycle and soak watering
+#define MAX_CYCLES 8
 
 // Uncomment the next line if you want schedules to turn off when you use manual control
 //#define DISABLE_SCHED_ON_MANUAL
@@ -53,9 +74,44 @@
 // Number of on/off cycles to execute per button press
 #define CHATTERBOX_CYCLES 10
 
+// GPIO chip driving the Direct Positive and Direct Negative outputs.  The boards' pin maps (Boards.h)
+//  still hold wiringPi pin numbers, which are mapped to the lines of the chip.  If the chip can't be
+//  opened, or it's commented out, the pins are driven through wiringPi one at a time instead.
+// Has no effect if ARDUINO is defined.
+#define GPIO_CHIP "/dev/gpiochip0"
+
+// Inputs on lines of GPIO_CHIP, by Broadcom number.  A rain sensor holds off the schedules while it's
+//  active, ending any that's running, and a flow switch is only logged.  Uncomment the ones that are
+//  wired.  Each is debounced by the kernel over INPUT_DEBOUNCE_US.
+// Has no effect if ARDUINO is defined, or GPIO_CHIP isn't.
+//#define RAIN_SENSOR_LINE 23
+//#define FLOW_SWITCH_LINE 24
+// inputs pull their line low when active, e.g. a normally open switch to ground
+#define INPUTS_ACTIVE_LOW true
+#define INPUT_DEBOUNCE_US 20000
+
+// A pulse flow meter on a line of GPIO_CHIP, by Broadcom number.  The water through it is shared out
+//  among the zones that are on and logged with each zone's run.  Uncomment if one is wired.
+// Has no effect if ARDUINO is defined, or GPIO_CHIP isn't.
+//#define FLOW_METER_LINE 25
+// e.g. 450 for the common YF-S201 hall effect meters
+#define FLOW_PULSES_PER_LITRE 450
+
+// SPI device to shift the OpenSprinkler outputs out through in one transfer, latching them with the
+//  latch pin through GPIO_CHIP.  The register's data and clock need to be wired to the SPI bus's MOSI
+//  and SCLK.  If the device can't be opened the pins are bit-banged through wiringPi as before.
+// Has no effect if ARDUINO is defined, or GPIO_CHIP isn't.
+//#define SR_SPI_DEVICE "/dev/spidev0.0"
+#define SR_SPI_SPEED 1000000
+
 // External script to use when "None" Output Type is selected.
 // If this script does not exist or is not executable, nothing will happen.
 // Has no effect if ARDUINO is defined.
 #define EXTERNAL_SCRIPT "/usr/local/bin/sprinklers_pi_zone"
 
+// Script kept running when the "Script" Output Type is selected.  It's sent a line with all the outputs
+//  each time they change, see Coprocess.h.
+// Has no effect if ARDUINO is defined.
+#define COPROCESS_SCRIPT "/usr/local/bin/sprinklers_pi_coprocess"
+
 #endif //SPRINKLERS_PI_CONFIG_H
@@ -6,6 +6,7 @@
 
 #include "core.h"
 #include "settings.h"
+#include "Controller.h"
 
 #if defined(WEATHER_WUNDERGROUND)
 #include "Wunderground.h"
@@ -23,40 +24,95 @@
 
 #include "web.h"
 #include "Event.h"
+#include "Calendar.h"
+#include "Solar.h"
+#ifndef ARDUINO
+#include "Journal.h"
+#include "FlowMeter.h"
+#endif
 #include "port.h"
+#include "Inputs.h"
 #include <stdlib.h>
 #ifdef ARDUINO
 #include "tftp.h"
 static tftp tftpServer;
 #else
-#include <wiringPi.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #endif
 
-#ifdef LOGGING
-Logging logger;
-#endif
+#ifndef SIMULATOR
 static web webServer;
+#endif
+#if !defined(ARDUINO) && !defined(SIMULATOR) && defined(GPIO_CHIP)
+#define HAVE_INPUTS
+static Inputs inputs;
+static int rainSensor = -1;
+#endif
 nntp nntpTimeServer;
-runStateClass runState;
+TimeContext tickTime;
 
 // A bitfield that defines which zones are currently on.
 int ZoneState = 0;
 
-runStateClass::runStateClass() : m_bSchedule(false), m_bManual(false), m_iSchedule(-1), m_zone(-1), m_endTime(0), m_eventTime(0)
+runStateClass::runStateClass() : m_bSchedule(false), m_bManual(false), m_iSchedule(-1), m_zone(-1), m_endTime(0)
 {
+	for (int i = 0; i <= NUM_ZONES; i++)
+	{
+		m_zoneStart[i] = 0;
+		m_zoneEnd[i] = 0;
+		m_zoneVolume[i] = 0;
+	}
 }
 
-void runStateClass::LogSchedule()
+void runStateClass::LogZone(int16_t zone, time_t timeNow)
 {
+	if ((zone <= 0) || (zone > NUM_ZONES) || (m_zoneStart[zone] == 0))
+		return;
 #ifdef LOGGING
-	if ((m_eventTime > 0) && (m_zone >= 0))
-		logger.LogZoneEvent(m_eventTime, m_zone, nntpTimeServer.LocalNow() - m_eventTime, m_bSchedule ? m_iSchedule+1:-1, m_adj.seasonal, m_adj.wunderground);
+	const int schedule = !m_bSchedule ? -1 : (m_iSchedule == QUICK_SCHEDULE) ? 0 : m_iSchedule + 1;
+	controller->m_logger.LogZoneEvent(m_zoneStart[zone], zone, timeNow - m_zoneStart[zone], schedule, m_adj.seasonal, m_adj.wunderground,
+			ZoneVolume(zone));
+#endif
+#ifdef SIMULATOR
+	SimZoneLogged(zone, timeNow - m_zoneStart[zone], ZoneVolume(zone));
 #endif
+	m_zoneStart[zone] = 0;
+}
+
+float runStateClass::ZoneVolume(int16_t zone)
+{
+#ifndef ARDUINO
+	if (flowMeter.IsCounting())
+		return m_zoneVolume[zone];
+#endif
+	return -1;
+}
+
+int runStateClass::ZonesOn()
+{
+	int count = 0;
+	for (int16_t zone = 1; zone <= NUM_ZONES; zone++)
+		if (m_zoneStart[zone] != 0)
+			count++;
+	return count;
+}
+
+void runStateClass::AddVolume(float litres)
+{
+	for (int16_t zone = 1; zone <= NUM_ZONES; zone++)
+		if (m_zoneStart[zone] != 0)
+			m_zoneVolume[zone] += litres;
 }
 
-void runStateClass::SetSchedule(bool val, int8_t iSched, const runStateClass::DurationAdjustments * adj)
+void runStateClass::LogSchedule()
+{
+	const time_t timeNow = tickTime.local;
+	for (int16_t zone = 1; zone <= NUM_ZONES; zone++)
+		LogZone(zone, timeNow);
+}
+
+void runStateClass::SetSchedule(bool val, int16_t iSched, const runStateClass::DurationAdjustments * adj)
 {
 	LogSchedule();
 	m_bSchedule = val;
@@ -64,152 +120,88 @@ void runStateClass::SetSchedule(bool val, int8_t iSched, const runStateClass::Du
 	m_zone = -1;
 	m_endTime = 0;
 	m_iSchedule = val?iSched:-1;
-	m_eventTime = nntpTimeServer.LocalNow();
 	m_adj = adj?*adj:DurationAdjustments();
 }
 
-void runStateClass::ContinueSchedule(int8_t zone, short endTime)
+void runStateClass::ContinueSchedule(int16_t zone, long endTime)
 {
 	LogSchedule();
 	m_bSchedule = true;
 	m_bManual = false;
+	StartZone(zone, endTime);
+}
+
+// Mark an additional zone as running alongside any others that are already on.
+void runStateClass::StartZone(int16_t zone, long endTime)
+{
+	if ((zone <= 0) || (zone > NUM_ZONES))
+		return;
 	m_zone = zone;
 	m_endTime = endTime;
-	m_eventTime = nntpTimeServer.LocalNow();
+	m_zoneStart[zone] = tickTime.local;
+	m_zoneEnd[zone] = endTime;
+	m_zoneVolume[zone] = 0;
+}
+
+void runStateClass::EndZone(int16_t zone)
+{
+	LogZone(zone, tickTime.local);
+	if (zone != m_zone)
+		return;
+	// report one of the zones that is still running, if any
+	m_zone = -1;
+	m_endTime = 0;
+	for (int16_t i = 1; i <= NUM_ZONES; i++)
+	{
+		if (m_zoneStart[i] != 0)
+		{
+			m_zone = i;
+			m_endTime = m_zoneEnd[i];
+			break;
+		}
+	}
 }
 
-void runStateClass::SetManual(bool val, int8_t zone)
+void runStateClass::SetManual(bool val, int16_t zone)
 {
 	LogSchedule();
 	m_bSchedule = false;
 	m_bManual = val;
-	m_zone = zone;
+	m_zone = -1;
 	m_endTime = 0;
 	m_iSchedule = -1;
-	m_eventTime = nntpTimeServer.LocalNow();
 	m_adj=DurationAdjustments();
+	if (val)
+		StartZone(zone, 0);
 }
 
-#ifdef ARDUINO
-uint8_t ZoneToIOMap[] = {22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37};
-#endif
-#if defined(GREENIQ)
-uint8_t ZoneToIOMap[] = {5, 7, 0, 1, 2, 3, 4};
-#else
-uint8_t ZoneToIOMap[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
-#define SR_CLK_PIN  7
-#define SR_NOE_PIN  0
-#define SR_DAT_PIN  2
-#define SR_LAT_PIN  3
-#endif
-
-static uint16_t outState;
-static uint16_t prevOutState;
-
 static void io_latch()
 {
 	// check if things have changed
-	if (outState == prevOutState)
+	if (controller->m_outState == controller->m_prevOutState)
 		return;
 
-	const EOT eot = GetOT();
-	switch (eot)
-	{
-	case OT_NONE:
-#ifndef ARDUINO
-#ifdef EXTERNAL_SCRIPT
-        struct stat buffer;
-        char cmd[50];
-        if (stat(EXTERNAL_SCRIPT, &buffer) == 0) {
-            for (int i = 0; i <= NUM_ZONES; i++)
-            {
-                sprintf(cmd, "%s %i %i", EXTERNAL_SCRIPT, i, (outState&(0x01<<i))?1:0);
-                system(cmd);
-            }
-        }
-#endif
-#endif
-		break;
-	case OT_DIRECT_POS:
-	case OT_DIRECT_NEG:
-		for (int i = 0; i <= NUM_ZONES; i++)
-		{
-			if (eot == OT_DIRECT_POS)
-				digitalWrite(ZoneToIOMap[i], (outState&(0x01<<i))?1:0);
-			else
-				digitalWrite(ZoneToIOMap[i], (outState&(0x01<<i))?0:1);
-		}
-		break;
-
-	case OT_OPEN_SPRINKLER:
-#ifndef ARDUINO
-#ifndef GREENIQ
-		// turn off the latch pin
-		digitalWrite(SR_LAT_PIN, 0);
-		digitalWrite(SR_CLK_PIN, 0);
-
-		for (uint8_t i = 0; i < 16; i++)
-		{
-			digitalWrite(SR_CLK_PIN, 0);
-			digitalWrite(SR_DAT_PIN, outState&(0x01<<(15-i)));
-			digitalWrite(SR_CLK_PIN, 1);
-		}
-		// latch the outputs
-		digitalWrite(SR_LAT_PIN, 1);
-
-		// Turn off the NOT enable pin (turns on outputs)
-		digitalWrite(SR_NOE_PIN, 0);
-#endif
-#endif
-		break;
-	}
+	controller->m_output->Latch(controller->m_outState);
 
 	// Now store the new output state so we know if things have changed
-	prevOutState = outState;
+	controller->m_prevOutState = controller->m_outState;
 }
 
 void io_setup()
 {
 	const EOT eot = GetOT();
-	if ((eot != OT_NONE))
+	delete controller->m_output;
+	controller->m_output = NewOutput(eot, controller->m_id);
+	if (!controller->m_output->Setup() && (eot != OT_NONE))
 	{
-
-#ifndef ARDUINO
-		if (geteuid() != 0)
-		{
-			trace("You need to be root to run this.  Setting output mode to NONE\n");
-			SetOT(OT_NONE);
-			return;
-		}
-		else if (wiringPiSetup() == -1)
-		{
-			trace("Failed to Setup Outputs\n");
-		}
-#endif
-		if (eot == OT_OPEN_SPRINKLER)
-		{
-#ifndef GREENIQ
-			pinMode(SR_CLK_PIN, OUTPUT);
-			digitalWrite(SR_CLK_PIN, 0);
-			pinMode(SR_NOE_PIN, OUTPUT);
-			digitalWrite(SR_NOE_PIN, 0);
-			pinMode(SR_DAT_PIN, OUTPUT);
-			digitalWrite(SR_DAT_PIN, 0);
-			pinMode(SR_LAT_PIN, OUTPUT);
-			digitalWrite(SR_LAT_PIN, 0);
-#endif
-		}
-		else
-		{
-			for (uint8_t i=0; i<sizeof(ZoneToIOMap); i++)
-			{
-				pinMode(ZoneToIOMap[i], OUTPUT);
-				digitalWrite(ZoneToIOMap[i], (eot==OT_DIRECT_NEG)?1:0);
-			}
-		}
+		trace("Failed to Setup Outputs.  Setting output mode to NONE\n");
+		// which sets up the outputs again
+		SetOT(OT_NONE);
+		return;
 	}
-	outState = 0;
-	prevOutState = 1;
+	controller->m_outState.Clear();
+	controller->m_prevOutState.Clear();
+	controller->m_prevOutState.Set(0);
 	io_latch();
 }
 
@@ -221,22 +213,32 @@ void io_latchNow()
 void TurnOffZones()
 {
 	trace(F("Turning Off All Zones\n"));
-	outState = 0;
+	controller->m_outState.Clear();
 }
 
 bool isZoneOn(int iNum)
 {
 	if ((iNum <= 0) || (iNum > NUM_ZONES))
 		return false;
-	return outState & (0x01 << iNum);
+	return controller->m_outState.Test(iNum);
 }
 
 static void pumpControl(bool val)
 {
-	if (val)
-		outState |= 0x01;
-	else
-		outState &= ~0x01;
+	controller->m_outState.Set(0, val);
+}
+
+// Run the pump if any of the zones that are currently on need it.
+static void updatePump()
+{
+	bool bPump = false;
+	for (int i = controller->m_outState.Next(0); (i != -1) && !bPump; i = controller->m_outState.Next(i))
+	{
+		ShortZone zone;
+		LoadShortZone(i - 1, &zone);
+		bPump = zone.bPump;
+	}
+	pumpControl(bPump);
 }
 
 void TurnOnZone(int iValve)
@@ -247,11 +249,43 @@ void TurnOnZone(int iValve)
 
 	ShortZone zone;
 	LoadShortZone(iValve - 1, &zone);
-	outState = 0x01 << iValve;
+	controller->m_outState.Clear();
+	controller->m_outState.Set(iValve);
 	// Turn on the pump if necessary
 	pumpControl(zone.bPump);
 }
 
+// Turn on a zone without touching any of the other zones that are already on.
+void OpenZone(int iValve)
+{
+	trace(F("Opening Zone %d\n"), iValve);
+	if ((iValve <= 0) || (iValve > NUM_ZONES))
+		return;
+	controller->m_outState.Set(iValve);
+	updatePump();
+}
+
+void CloseZone(int iValve)
+{
+	trace(F("Closing Zone %d\n"), iValve);
+	if ((iValve <= 0) || (iValve > NUM_ZONES))
+		return;
+	controller->m_outState.Reset(iValve);
+	updatePump();
+}
+
+int16_t GetLastWeatherScale()
+{
+	return controller->m_lastWeatherScale;
+}
+
+// Scale the durations by a percentage
+static void ScaleDurations(Schedule * sched, long scale)
+{
+	for (uint8_t k = 0; k < NUM_ZONES; k++)
+		sched->zone_duration[k] = (uint16_t)spi_min(((long)sched->zone_duration[k] * scale + 50) / 100, 65535L);
+}
+
 // Adjust the durations based on atmospheric conditions
 static runStateClass::DurationAdjustments AdjustDurations(Schedule * sched)
 {
@@ -273,14 +307,111 @@ static runStateClass::DurationAdjustments AdjustDurations(Schedule * sched)
 #endif
 		// get factor to adjust times by.  100 = 100% (i.e. no adjustment)
 		adj.wunderground = w.GetScale();
+		controller->m_lastWeatherScale = adj.wunderground;
 	}
 	adj.seasonal = GetSeasonalAdjust();
-	long scale = ((long)adj.seasonal * (long)adj.wunderground) / 100;
-	for (uint8_t k = 0; k < NUM_ZONES; k++)
-		sched->zone_duration[k] = (uint8_t)spi_min(((long)sched->zone_duration[k] * scale + 50) / 100, 255);
+	ScaleDurations(sched, ((long)adj.seasonal * (long)adj.wunderground) / 100);
 	return adj;
 }
 
+// Work out when each zone of a schedule runs, starting at start_time.
+//  A zone with a max cycle time set has its run split into equal cycles no longer than that, and
+//  each cycle waits at least the zone's soak time after the previous one.  Other zones fill in
+//  while a zone soaks.  With no flow capacity configured one zone runs at a time; otherwise zones
+//  are packed into the capacity and a zone with no flow cost set always runs by itself.
+//  Whenever there is room, the zone with the longest chain of run and soak time left goes next
+//  (ties in zone order), which keeps the whole schedule close to the shortest possible.
+//  The runs are returned in the order they start.
+int BuildZoneRuns(const Schedule & sched, long start_time, ZoneRun * runs, int max_runs)
+{
+	const uint8_t capacity = GetFlowCapacity();
+	const bool bConcurrent = capacity > 0;
+	uint8_t cost[NUM_ZONES];
+	uint8_t cycles[NUM_ZONES];		// cycles left to run
+	long cycle_len[NUM_ZONES];
+	uint8_t extra[NUM_ZONES];		// how many of the cycles left get an extra second
+	long soak[NUM_ZONES];
+	long ready[NUM_ZONES];			// when the next cycle may start
+	int iNumRuns = 0;
+
+	for (uint8_t k = 0; k < NUM_ZONES; k++)
+	{
+		FullZone zone;
+		LoadZone(k, &zone);
+		cycles[k] = 0;
+		if (!zone.bEnabled || (sched.zone_duration[k] == 0))
+			continue;
+		const long duration = sched.zone_duration[k];
+		uint8_t n = 1;
+		if ((zone.cycle > 0) && (duration > zone.cycle * 60L))
+			n = spi_min((duration + zone.cycle * 60L - 1) / (zone.cycle * 60L), (long)MAX_CYCLES);
+		cycles[k] = n;
+		cycle_len[k] = duration / n;
+		extra[k] = duration % n;
+		soak[k] = zone.soak * 60L;
+		ready[k] = start_time;
+		if (bConcurrent)
+			cost[k] = ((zone.flow == 0) || (zone.flow > capacity)) ? capacity : zone.flow;
+		else
+			cost[k] = 1;
+	}
+
+	long time_now = start_time;
+	while (iNumRuns < max_runs)
+	{
+		int load = 0;
+		for (int i = 0; i < iNumRuns; i++)
+			if (runs[i].end > time_now)
+				load += cost[runs[i].zone - 1];
+
+		// start as many zones as will fit, best first
+		while (iNumRuns < max_runs)
+		{
+			int best = -1;
+			long best_key = 0;
+			for (uint8_t k = 0; k < NUM_ZONES; k++)
+			{
+				if ((cycles[k] == 0) || (ready[k] > time_now) || (load + cost[k] > (bConcurrent ? capacity : 1)))
+					continue;
+				// one zone at a time the total run time is fixed, so only the soaking matters
+				long key = (cycles[k] - 1) * soak[k];
+				if (bConcurrent)
+					key += cycles[k] * cycle_len[k] + extra[k];
+				if ((best == -1) || (key > best_key))
+				{
+					best = k;
+					best_key = key;
+				}
+			}
+			if (best == -1)
+				break;
+			const long len = cycle_len[best] + ((extra[best] > 0) ? 1 : 0);
+			if (extra[best] > 0)
+				extra[best]--;
+			cycles[best]--;
+			ready[best] = time_now + len + soak[best];
+			load += cost[best];
+			runs[iNumRuns].zone = best + 1;
+			runs[iNumRuns].start = time_now;
+			runs[iNumRuns].end = time_now + len;
+			iNumRuns++;
+		}
+
+		// move on to the next time a zone finishes or is done soaking
+		long next_time = -1;
+		for (int i = 0; i < iNumRuns; i++)
+			if ((runs[i].end > time_now) && ((next_time == -1) || (runs[i].end < next_time)))
+				next_time = runs[i].end;
+		for (uint8_t k = 0; k < NUM_ZONES; k++)
+			if ((cycles[k] > 0) && (ready[k] > time_now) && ((next_time == -1) || (ready[k] < next_time)))
+				next_time = ready[k];
+		if (next_time == -1)
+			break;
+		time_now = next_time;
+	}
+	return iNumRuns;
+}
+
 // Load the on/off events for a specific schedule/time or the quick schedule
 void LoadSchedTimeEvents(uint8_t sched_num, bool bQuickSchedule)
 {
@@ -295,53 +426,226 @@ void LoadSchedTimeEvents(uint8_t sched_num, bool bQuickSchedule)
 		adj=AdjustDurations(&sched);
 	}
 	else
-		sched = quickSchedule;
+		sched = controller->m_quickSchedule;
 
-	const time_t local_now = nntpTimeServer.LocalNow();
-	short start_time = (local_now - previousMidnight(local_now)) / 60;
+	const long start_time = tickTime.seconds;
+	long end_time = start_time;
+	const int first_event = controller->m_iNumEvents;
 
-	for (uint8_t k = 0; k < NUM_ZONES; k++)
+	// with a flow capacity set zones overlap, so each one gets its own off event.  One zone at a
+	//  time, turning on the next zone turns off the last, so only gaps for soaking need an off event.
+	const bool bConcurrent = GetFlowCapacity() > 0;
+	ZoneRun runs[NUM_ZONES * MAX_CYCLES];
+	const int iNumRuns = BuildZoneRuns(sched, start_time, runs, NUM_ZONES * MAX_CYCLES);
+	for (int i = 0; i < iNumRuns; i++)
 	{
-		ShortZone zone;
-		LoadShortZone(k, &zone);
-		if (zone.bEnabled && (sched.zone_duration[k] > 0))
+		const bool bOffEvent = bConcurrent || ((i + 1 < iNumRuns) && (runs[i + 1].start > runs[i].end));
+		if (controller->m_iNumEvents >= MAX_EVENTS - (bOffEvent ? 2 : 1))
+		{  // make sure we have room for this zone's events && the last off event.
+			trace(F("ERROR: Too Many Events!\n"));
+			break;
+		}
+		Event & on = controller->m_events[controller->m_iNumEvents++];
+		on.time = runs[i].start;
+		on.command = bConcurrent ? 0x04 : 0x01; // Turn on a zone
+		on.data[0] = runs[i].zone; // Zone to turn on
+		on.data[1] = 0;
+		on.data[2] = 0;
+		on.end = runs[i].end;
+		if (bOffEvent)
 		{
-			if (iNumEvents >= MAX_EVENTS - 1)
-			{  // make sure we have room for the on && the off events.. hence the -1
-				trace(F("ERROR: Too Many Events!\n"));
-			}
-			else
-			{
-				events[iNumEvents].time = start_time;
-				events[iNumEvents].command = 0x01; // Turn on a zone
-				events[iNumEvents].data[0] = k + 1; // Zone to turn on
-				events[iNumEvents].data[1] = (start_time + sched.zone_duration[k]) >> 8;
-				events[iNumEvents].data[2] = (start_time + sched.zone_duration[k]) & 0x00FF;
-				iNumEvents++;
-				start_time += sched.zone_duration[k];
-			}
+			Event & off = controller->m_events[controller->m_iNumEvents++];
+			off.time = runs[i].end;
+			off.command = 0x05; // Turn off a zone
+			off.data[0] = runs[i].zone;
+			off.data[1] = 0;
+			off.data[2] = 0;
+			off.end = 0;
 		}
+		end_time = spi_max(end_time, runs[i].end);
 	}
 	// Load up the last turn off event.
-	events[iNumEvents].time = start_time;
-	events[iNumEvents].command = 0x02; // Turn off all zones
-	events[iNumEvents].data[0] = 0;
-	events[iNumEvents].data[1] = 0;
-	events[iNumEvents].data[2] = 0;
-	iNumEvents++;
-	runState.SetSchedule(true, bQuickSchedule?99:sched_num, &adj);
+	Event & event = controller->m_events[controller->m_iNumEvents++];
+	event.time = end_time;
+	event.command = 0x02; // Turn off all zones
+	event.data[0] = 0;
+	event.data[1] = 0;
+	event.data[2] = 0;
+	event.end = 0;
+	controller->m_runState.SetSchedule(true, bQuickSchedule?QUICK_SCHEDULE:sched_num, &adj);
+
+#ifndef ARDUINO
+	controller->m_journal.RunStarted(bQuickSchedule?QUICK_SCHEDULE:sched_num, adj.seasonal, adj.wunderground, tickTime.day);
+	for (int i = first_event; i < controller->m_iNumEvents; i++)
+	{
+		const Event & queued = controller->m_events[i];
+		controller->m_journal.EventQueued(queued.command, queued.data[0], queued.time, queued.end);
+	}
+#endif
 }
 
 void ClearEvents()
 {
-	iNumEvents = 0;
-	runState.SetSchedule(false);
+#ifndef ARDUINO
+	if (controller->m_runState.isSchedule())
+		controller->m_journal.RunEnded();
+#endif
+	controller->m_iNumEvents = 0;
+	controller->m_runState.SetSchedule(false);
 }
 
+#ifndef ARDUINO
+// Pick up a schedule run that was cut short by a restart.  Zones that should still be on go back on
+//  straight away and the rest of the run carries on as it was loaded.
+static void ResumeRun()
+{
+	// the start, every event of the run and its end.  Kept off the stack, there can be a lot of them.
+	static JournalRecord records[MAX_EVENTS + 2];
+	const int count = controller->m_journal.Read(records, MAX_EVENTS + 2);
+	if ((count == 0) || (records[0].type != JournalRecord::START))
+		return;
+
+	const long time_now = tickTime.seconds;
+	if (records[0].time != tickTime.day)
+		return;
+	// nothing to do if the run finished, or would have by now
+	for (int i = 1; i < count; i++)
+	{
+		if ((records[i].type == JournalRecord::END)
+				|| ((records[i].type == JournalRecord::EVENT) && (records[i].command == 0x02) && (records[i].time <= time_now)))
+			return;
+	}
+
+	trace(F("Resuming schedule %d\n"), records[0].data);
+	runStateClass::DurationAdjustments adj;
+	adj.seasonal = records[0].seasonal;
+	adj.wunderground = records[0].weather;
+	controller->m_runState.SetSchedule(true, records[0].data, &adj);
+	for (int i = 1; i < count; i++)
+	{
+		const JournalRecord & record = records[i];
+		if (record.type != JournalRecord::EVENT)
+			continue;
+		long time = record.time;
+		if (time <= time_now)
+		{
+			// only the zones that are part way through their run are left from the past
+			if (((record.command != 0x01) && (record.command != 0x04)) || (record.end <= time_now))
+				continue;
+			time = time_now;
+		}
+		if (controller->m_iNumEvents >= MAX_EVENTS)
+		{
+			trace(F("ERROR: Too Many Events!\n"));
+			break;
+		}
+		Event & event = controller->m_events[controller->m_iNumEvents++];
+		event.time = time;
+		event.command = record.command;
+		event.data[0] = record.data;
+		event.data[1] = 0;
+		event.data[2] = 0;
+		event.end = record.end;
+	}
+}
+#endif
+
 // TODO:  Schedules that go past midnight!
 //  Pretty simple.  When we one-shot at midnight, check to see if any outstanding events are at time >1400.  If so, move them
 //  to the top of the event stack and subtract 1440 (24*60) from their times.
 
+// data[1] of a start event is which start time it is, or this for a cron schedule's start
+#define CRON_START 4
+
+static void QueueStartEvent(uint8_t sched_num, uint8_t j, long time)
+{
+	if (controller->m_iNumEvents >= MAX_EVENTS)
+	{
+		trace(F("ERROR: Too Many Events!\n"));
+		return;
+	}
+	Event & event = controller->m_events[controller->m_iNumEvents++];
+	event.time = time;
+	event.command = 0x03;  // load events for schedule i, time j
+	event.data[0] = sched_num;
+	event.data[1] = j;
+	event.data[2] = 0;
+	event.end = 0;
+}
+
+// Queue up the start events for one schedule's start times today.  A cron schedule can start many
+//  times a day, so only its next start is queued, and the one after that when it fires.
+static void LoadStartEvents(uint8_t sched_num, const TimeContext & now, bool bAllEvents)
+{
+	Schedule sched;
+	LoadSchedule(sched_num, &sched);
+	if (!(controller->m_calendar.Days(sched_num, sched, now) & 0x01))
+		return;
+
+	if (sched.IsCron())
+	{
+		const short start_time = sched.cron.NextMinute(bAllEvents ? -1 : now.seconds / 60);
+		if (start_time != -1)
+			QueueStartEvent(sched_num, CRON_START, start_time * 60L);
+		return;
+	}
+
+	// now load up events for each of the start times.
+	for (uint8_t j = 0; j <= 3; j++)
+	{
+		const short start_time = StartMinute(sched.time[j], now.day, now.offset);
+		if (start_time != -1)
+		{
+			if (!bAllEvents && (start_time * 60L <= now.seconds))
+				continue;
+			QueueStartEvent(sched_num, j, start_time * 60L);
+		}
+	}
+}
+
+// Drop the pending start events for a schedule, or for every schedule if sched_num is -1.
+//  Events that have already fired are kept.
+static void RemoveStartEvents(int sched_num)
+{
+	int j = 0;
+	for (int i = 0; i < controller->m_iNumEvents; i++)
+	{
+		const Event & event = controller->m_events[i];
+		if ((event.time != -1) && (event.command == 0x03) && ((sched_num == -1) || (event.data[0] == sched_num)))
+			continue;
+		controller->m_events[j++] = controller->m_events[i];
+	}
+	controller->m_iNumEvents = j;
+}
+
+// Drop the pending zone events of the run in progress.
+static void RemoveRunEvents()
+{
+	int j = 0;
+	for (int i = 0; i < controller->m_iNumEvents; i++)
+	{
+		const Event & event = controller->m_events[i];
+		if ((event.time != -1) && (event.command != 0x03))
+			continue;
+		controller->m_events[j++] = controller->m_events[i];
+	}
+	controller->m_iNumEvents = j;
+}
+
+// End the run in progress, but only if it belongs to schedule sched_num.
+static void StopScheduleRun(uint8_t sched_num)
+{
+	if (!controller->m_runState.isSchedule() || (controller->m_runState.getSchedule() != sched_num))
+		return;
+	trace(F("Stopping schedule %d\n"), sched_num);
+	RemoveRunEvents();
+	TurnOffZones();
+	controller->m_runState.SetSchedule(false);
+#ifndef ARDUINO
+	controller->m_journal.RunEnded();
+#endif
+}
+
 // Loads the events for the current day
 void ReloadEvents(bool bAllEvents)
 {
@@ -352,72 +656,255 @@ void ReloadEvents(bool bAllEvents)
 	if (!GetRunSchedules())
 		return;
 
-	const time_t time_now = nntpTimeServer.LocalNow();
 	const uint8_t iNumSchedules = GetNumSchedules();
 	for (uint8_t i = 0; i < iNumSchedules; i++)
+		LoadStartEvents(i, tickTime, bAllEvents);
+}
+
+// Rebuild the remaining start events for today without disturbing anything that is running.
+void ReloadStartEvents()
+{
+	RemoveStartEvents(-1);
+	if (!GetRunSchedules())
+		return;
+
+	const uint8_t iNumSchedules = GetNumSchedules();
+	for (uint8_t i = 0; i < iNumSchedules; i++)
+		LoadStartEvents(i, tickTime, false);
+}
+
+// A schedule has been added or edited.  Only its own start events are replaced, and a run in progress
+//  is only stopped if it is this schedule's.
+void ScheduleChanged(uint8_t sched_num)
+{
+	StopScheduleRun(sched_num);
+	RemoveStartEvents(sched_num);
+	if (GetRunSchedules())
+		LoadStartEvents(sched_num, tickTime, false);
+}
+
+// A schedule has been deleted, and the ones after it have moved down a slot.
+void ScheduleDeleted(uint8_t sched_num)
+{
+	StopScheduleRun(sched_num);
+	RemoveStartEvents(sched_num);
+	for (int i = 0; i < controller->m_iNumEvents; i++)
 	{
-		Schedule sched;
-		LoadSchedule(i, &sched);
-		if (sched.IsRunToday(time_now))
+		Event & event = controller->m_events[i];
+		if ((event.time != -1) && (event.command == 0x03) && (event.data[0] > sched_num))
+			event.data[0]--;
+	}
+	const int16_t iRunning = controller->m_runState.getSchedule();
+	if (controller->m_runState.isSchedule() && (iRunning > sched_num) && (iRunning != QUICK_SCHEDULE))
+		controller->m_runState.RenumberSchedule(iRunning - 1);
+}
+
+// Adjust the durations the way they are expected to be when the schedule runs: the current seasonal
+//  adjustment and, if bWeather is set, the last weather scale.
+void ProjectDurations(Schedule * sched, bool bWeather)
+{
+	const long weather = (bWeather && sched->IsWAdj() && (controller->m_lastWeatherScale >= 0)) ? controller->m_lastWeatherScale : 100;
+	ScaleDurations(sched, (GetSeasonalAdjust() * weather) / 100);
+}
+
+// Work out the zone runs for the days ahead, starting with today, and hand each one to callback in the
+//  order they start.  Today's start times that have already gone by are skipped.  Durations get the
+//  current seasonal adjustment and, if bWeather is set, the last weather scale.  Like the events, a
+//  start time that comes up while another schedule is running waits until that one is done, and
+//  nothing carries on past midnight.  Cron starts missed while waiting are skipped.
+void BuildPlan(const TimeContext & now, int days, bool bWeather, PlanCallback callback, void * context)
+{
+	if (!GetRunSchedules())
+		return;
+
+	const uint8_t iNumSchedules = GetNumSchedules();
+	// kept off the stack, there can be a lot of them
+	static Schedule scheds[MAX_SCHEDULES];
+	for (uint8_t i = 0; i < iNumSchedules; i++)
+	{
+		LoadSchedule(i, &scheds[i]);
+		ProjectDurations(&scheds[i], bWeather);
+	}
+
+	const time_t today = previousMidnight(now.local);
+	// the run going on now holds up today's start times until its turn off event
+	long busy_until = -1;
+	if (controller->m_runState.isSchedule())
+		for (int i = 0; i < controller->m_iNumEvents; i++)
+		{
+			const Event & event = controller->m_events[i];
+			if ((event.time != -1) && (event.command == 0x02))
+				busy_until = spi_max(busy_until, event.time);
+		}
+
+	CalendarDays run_days[MAX_SCHEDULES];
+	ZoneRun runs[NUM_ZONES * MAX_CYCLES];
+	for (int d = 0; d < days; d++)
+	{
+		const time_t day_start = today + d * SECS_PER_DAY;
+		const CalendarDays day_bit = (CalendarDays) 1 << (d % CALENDAR_DAYS);
+		if (day_bit == 1)
+			for (uint8_t i = 0; i < iNumSchedules; i++)
+				run_days[i] = Calendar::Compile(scheds[i], elapsedDays(day_start));
+
+		// the start times for the day.  They are kept in schedule order, which is the order waiting
+		//  start times go in once the running schedule is done.
+		long start_time[MAX_SCHEDULES * 4];
+		uint8_t start_sched[MAX_SCHEDULES * 4];
+		int iNumStarts = 0;
+		for (uint8_t i = 0; i < iNumSchedules; i++)
 		{
-			// now load up events for each of the start times.
+			if (!(run_days[i] & day_bit))
+				continue;
+			// like the events, only a cron schedule's next start is lined up
+			if (scheds[i].IsCron())
+			{
+				const short start_minute = scheds[i].cron.NextMinute((d == 0) ? now.seconds / 60 : -1);
+				if (start_minute == -1)
+					continue;
+				start_time[iNumStarts] = start_minute * 60L;
+				start_sched[iNumStarts] = i;
+				iNumStarts++;
+				continue;
+			}
 			for (uint8_t j = 0; j <= 3; j++)
 			{
-				const short start_time = sched.time[j];
-				if (start_time != -1)
+				const short start_minute = StartMinute(scheds[i].time[j], now.day + d, now.offset);
+				const long start = start_minute * 60L;
+				if ((start_minute == -1) || ((d == 0) && (start <= now.seconds)))
+					continue;
+				start_time[iNumStarts] = start;
+				start_sched[iNumStarts] = i;
+				iNumStarts++;
+			}
+		}
+
+		long free_time = (d == 0) ? busy_until : -1;
+		while (iNumStarts > 0)
+		{
+			// anything already waiting goes first, in schedule order, otherwise the next one to come up
+			int next = -1;
+			for (int k = 0; k < iNumStarts; k++)
+			{
+				if (start_time[k] <= free_time)
 				{
-					if (!bAllEvents && (start_time <= (long)(time_now - previousMidnight(time_now))/60 ))
-						continue;
-					if (iNumEvents >= MAX_EVENTS)
-					{
-						trace(F("ERROR: Too Many Events!\n"));
-					}
-					else
-					{
-						events[iNumEvents].time = start_time;
-						events[iNumEvents].command = 0x03;  // load events for schedule i, time j
-						events[iNumEvents].data[0] = i;
-						events[iNumEvents].data[1] = j;
-						events[iNumEvents].data[2] = 0;
-						iNumEvents++;
-					}
+					next = k;
+					break;
 				}
+				if ((next == -1) || (start_time[k] < start_time[next]))
+					next = k;
+			}
+			const long start = spi_max(start_time[next], free_time + 1);
+			const uint8_t sched_num = start_sched[next];
+			iNumStarts--;
+			for (int k = next; k < iNumStarts; k++)
+			{
+				start_time[k] = start_time[k + 1];
+				start_sched[k] = start_sched[k + 1];
+			}
+			if (start >= (long)SECS_PER_DAY)
+				break;
+			// and its next one goes in at the back when it starts
+			if (scheds[sched_num].IsCron())
+			{
+				const short start_minute = scheds[sched_num].cron.NextMinute(start / 60);
+				if (start_minute != -1)
+				{
+					start_time[iNumStarts] = start_minute * 60L;
+					start_sched[iNumStarts] = sched_num;
+					iNumStarts++;
+				}
+			}
+
+			const int iNumRuns = BuildZoneRuns(scheds[sched_num], start, runs, NUM_ZONES * MAX_CYCLES);
+			free_time = start;
+			for (int k = 0; k < iNumRuns; k++)
+			{
+				free_time = spi_max(free_time, runs[k].end);
+				if (runs[k].start >= (long)SECS_PER_DAY)
+					continue;
+				PlannedRun run;
+				run.sched = sched_num;
+				run.zone = runs[k].zone;
+				run.start = day_start + runs[k].start;
+				run.end = day_start + spi_min(runs[k].end, (long)SECS_PER_DAY);
+				callback(run, context);
 			}
 		}
 	}
 }
 
 // Check to see if there are any events that need to be processed.
-static void ProcessEvents()
+// Processed events are kept until the events are reloaded.  A cron schedule can start often enough to
+//  fill up the events before midnight, so once there isn't room for another run they are dropped.
+static void DropProcessedEvents()
+{
+	int j = 0;
+	for (int i = 0; i < controller->m_iNumEvents; i++)
+	{
+		if (controller->m_events[i].time != -1)
+			controller->m_events[j++] = controller->m_events[i];
+	}
+	controller->m_iNumEvents = j;
+}
+
+// While bHeld the start events are dropped as they come due, but the runs that are already loaded,
+//  e.g. a quick schedule, carry on.
+static void ProcessEvents(const TimeContext & now, bool bHeld)
 {
-	const time_t local_now = nntpTimeServer.LocalNow();
-	const short time_check = (local_now - previousMidnight(local_now)) / 60;
-	for (uint8_t i = 0; i < iNumEvents; i++)
+	const long time_check = now.seconds;
+	if (controller->m_iNumEvents > MAX_EVENTS - NUM_ZONES * MAX_CYCLES * 2 - 2)
+		DropProcessedEvents();
+	// start events waiting on a run go in the order they are in the events once it has ended, so one
+	//  after the run's off event doesn't jump ahead of the ones before it
+	bool bRunEnded = false;
+	for (int i = 0; i < controller->m_iNumEvents; i++)
 	{
-		if (events[i].time == -1)
+		Event & event = controller->m_events[i];
+		if (event.time == -1)
 			continue;
-		if (time_check >= events[i].time)
+		if (time_check >= event.time)
 		{
-			switch (events[i].command)
+			switch (event.command)
 			{
 			case 0x01:  // turn on valves in data[0]
-				TurnOnZone(events[i].data[0]);
-				runState.ContinueSchedule(events[i].data[0], events[i].data[1] << 8 | events[i].data[2]);
-				events[i].time = -1;
+				TurnOnZone(event.data[0]);
+				controller->m_runState.ContinueSchedule(event.data[0], event.end);
+				event.time = -1;
+				break;
+			case 0x04:  // turn on valve data[0] alongside the ones already on
+				OpenZone(event.data[0]);
+				controller->m_runState.StartZone(event.data[0], event.end);
+				event.time = -1;
+				break;
+			case 0x05:  // turn off valve data[0]
+				CloseZone(event.data[0]);
+				controller->m_runState.EndZone(event.data[0]);
+				event.time = -1;
 				break;
 			case 0x02:  // turn off all valves
 				TurnOffZones();
-				runState.SetSchedule(false);
-				events[i].time = -1;
+				controller->m_runState.SetSchedule(false);
+#ifndef ARDUINO
+				controller->m_journal.RunEnded();
+#endif
+				event.time = -1;
+				bRunEnded = true;
 				break;
 			case 0x03:  // load events for schedule(data[0]) time(data[1])
-				if (runState.isSchedule())  // If we're already running a schedule, push this off 1 minute
-					events[i].time++;
+				if (bHeld)
+					event.time = -1;
+				else if (controller->m_runState.isSchedule() || bRunEnded)  // If we're already running a schedule, push this off 1 second
+					event.time++;
 				else
 				{
 					// Load all the individual events for the individual zones on/off
-					LoadSchedTimeEvents(events[i].data[0]);
-					events[i].time = -1;
+					const uint8_t sched_num = event.data[0];
+					const bool bCron = (event.data[1] == CRON_START);
+					LoadSchedTimeEvents(sched_num);
+					event.time = -1;
+					if (bCron)
+						LoadStartEvents(sched_num, now, false);
 				}
 				break;
 			};
@@ -425,72 +912,192 @@ static void ProcessEvents()
 	}
 }
 
+// Get the current controller going: its settings, outputs and log, and the events for the rest of today
+static void StartController()
+{
+	if (IsFirstBoot())
+		ResetEEPROM();
+	io_setup();
+
+#ifdef LOGGING
+	if (!controller->m_logger.Init(controller->m_dir))
+		exit(EXIT_FAILURE);
+#endif
+
+	TurnOffZones();
+	ClearEvents();
+	ReloadEvents();
+#ifndef ARDUINO
+	ResumeRun();
+#endif
+	controller->m_bStarted = true;
+}
+
+#ifdef HAVE_INPUTS
+static void SetupInputs()
+{
+#ifdef RAIN_SENSOR_LINE
+	rainSensor = inputs.Add(GPIO_CHIP, RAIN_SENSOR_LINE, "rain sensor", INPUTS_ACTIVE_LOW, INPUT_DEBOUNCE_US);
+#endif
+#ifdef FLOW_SWITCH_LINE
+	inputs.Add(GPIO_CHIP, FLOW_SWITCH_LINE, "flow switch", INPUTS_ACTIVE_LOW, INPUT_DEBOUNCE_US);
+#endif
+#ifdef FLOW_METER_LINE
+	flowMeter.Start(GPIO_CHIP, FLOW_METER_LINE);
+#endif
+}
+#endif
+
+#ifndef ARDUINO
+// Share out the water that's gone through the meter since the last time among the zones that are on, in
+//  every controller.  Water with nothing on isn't put down to any zone.
+void ShareFlow()
+{
+	static uint32_t lastPulses = 0;
+	const uint32_t pulses = flowMeter.Pulses();
+	if (pulses == lastPulses)
+		return;
+	const uint32_t newPulses = pulses - lastPulses;
+	lastPulses = pulses;
+	int zones = 0;
+	for (int i = 0; i < iNumControllers; i++)
+		zones += controllers[i]->m_runState.ZonesOn();
+	if (zones == 0)
+		return;
+	const float litres = (float) newPulses / FLOW_PULSES_PER_LITRE / zones;
+	for (int i = 0; i < iNumControllers; i++)
+		controllers[i]->m_runState.AddVolume(litres);
+}
+#endif
+
+bool SchedulesHeld()
+{
+#ifdef HAVE_INPUTS
+	return inputs.IsActive(rainSensor);
+#else
+	return false;
+#endif
+}
+
+#if !defined(ARDUINO) && !defined(SIMULATOR)
+void WaitForInputs(int ms)
+{
+#ifdef HAVE_INPUTS
+	if (inputs.Count())
+	{
+		inputs.Wait(ms);
+		return;
+	}
+#endif
+	usleep(ms * 1000);
+}
+#endif
+
 void mainLoop()
 {
 	static bool firstLoop = true;
 	static bool bDoneMidnightReset = false;
+
+	// Check to see if we need to set the clock and do so if necessary.
+	nntpTimeServer.checkTime();
+
+	tickTime.Set(nntpTimeServer.utcNow());
+	// One shot at midnight
+	bool bMidnight = false;
+	if ((tickTime.hour == 0) && !bDoneMidnightReset)
+	{
+		trace(F("Reloading Midnight\n"));
+		bDoneMidnightReset = true;
+		bMidnight = true;
+	}
+	else if (tickTime.hour != 0)
+		bDoneMidnightReset = false;
+
+	for (int i = 0; i < iNumControllers; i++)
+	{
+		controller = controllers[i];
+		if (!controller->m_bStarted)
+			StartController();
+		// TODO:  outstanding midnight events.  See other TODO for how.
+		if (bMidnight)
+			ReloadEvents(true);
+	}
+	controller = controllers[0];
+
 	if (firstLoop)
 	{
 		firstLoop = false;
 		freeMemory();
 
-		if (IsFirstBoot())
-			ResetEEPROM();
-		io_setup();
-
-#ifdef LOGGING
-		if (!logger.Init())
-			exit(EXIT_FAILURE);
+#ifdef HAVE_INPUTS
+		SetupInputs();
 #endif
 
-		TurnOffZones();
-		ClearEvents();
-
+#ifndef SIMULATOR
 		//Init the web server
 		if (!webServer.Init())
 			exit(EXIT_FAILURE);
+#endif
 
 #ifdef ARDUINO
 		//Init the TFTP server
 		tftpServer.Init();
 #endif
-
-		// Set the clock.
-		nntpTimeServer.checkTime();
-
-		ReloadEvents();
 		//ShowSockStatus();
 	}
 
-	// Check to see if we need to set the clock and do so if necessary.
-	nntpTimeServer.checkTime();
+#ifndef SIMULATOR
+	//  See if any web clients have connected
+	webServer.ProcessWebClients();
+#endif
 
-	const time_t timeNow = nntpTimeServer.LocalNow();
-	// One shot at midnight
-	if ((hour(timeNow) == 0) && !bDoneMidnightReset)
+#ifndef ARDUINO
+	// before any zone is turned off, so it gets what went through it
+	ShareFlow();
+#endif
+
+	// A rain sensor holds off the schedules, ending any of their runs that's going.  Quick schedules and
+	//  manual zones are left to the user.  When it lets go the rest of the day's start times are loaded
+	//  again.
+	static bool bWasHeld = false;
+	const bool bHeld = SchedulesHeld();
+	if (bHeld && !bWasHeld)
+		trace(F("Holding off the schedules\n"));
+	else if (!bHeld && bWasHeld)
+		trace(F("Running the schedules again\n"));
+
+	for (int i = 0; i < iNumControllers; i++)
 	{
-		trace(F("Reloading Midnight\n"));
-		bDoneMidnightReset = true;
-		// TODO:  outstanding midnight events.  See other TODO for how.
-		ReloadEvents(true);
-	}
-	else if (hour(timeNow) != 0)
-		bDoneMidnightReset = false;
+		controller = controllers[i];
 
-	//  See if any web clients have connected
-	webServer.ProcessWebClients();
+		if (bHeld && !bWasHeld && controller->m_runState.isSchedule() && (controller->m_runState.getSchedule() != QUICK_SCHEDULE))
+		{
+			TurnOffZones();
+			ClearEvents();
+		}
+		else if (!bHeld && bWasHeld)
+			ReloadStartEvents();
+
+		// Process any pending events.
+		ProcessEvents(tickTime, bHeld);
+
+		// e.g. pick up acknowledgements from, or restart, the output script
+		controller->m_output->Poll();
+
+#if !defined(ARDUINO) && !defined(SIMULATOR)
+		// if we've changed the settings, store them to disk.  The simulator's only ever in memory.
+		controller->m_eeprom.Store();
+		controller->m_journal.Sync();
+#endif
 
-	// Process any pending events.
-	ProcessEvents();
+		// latch any output modifications
+		io_latch();
+	}
+	controller = controllers[0];
+	bWasHeld = bHeld;
 
 #ifdef ARDUINO
 	// Process the TFTP Server
 	tftpServer.Poll();
-#else
-	// if we've changed the settings, store them to disk
-	EEPROM.Store();
 #endif
-
-	// latch any output modifications
-	io_latch();
 }
@@ -12,25 +12,72 @@
 #endif
 #include <inttypes.h>
 #include "port.h"
+#include "config.h"
+#include "ZoneSet.h"
 #ifdef LOGGING
 #include "Logging.h"
-extern Logging logger;
 #endif
 
 #ifndef VERSION
 #define VERSION "0.0.0"
 #endif
 
+class Schedule;
+
+// A single zone run produced by the event builder.  Times are in seconds past midnight.
+struct ZoneRun
+{
+	uint8_t zone;
+	long start;
+	long end;
+};
+
+// A zone run projected by BuildPlan.  Times are local, in seconds since 1970.
+struct PlannedRun
+{
+	uint8_t sched;
+	uint8_t zone;
+	time_t start;
+	time_t end;
+};
+typedef void (*PlanCallback)(const PlannedRun & run, void * context);
+
 void mainLoop();
+#if !defined(ARDUINO) && !defined(SIMULATOR)
+// Wait up to ms for something to happen on the inputs, in place of sleeping between loops
+void WaitForInputs(int ms);
+#endif
+// Whether the schedules are held off, by a rain sensor that's active
+bool SchedulesHeld();
+#ifndef ARDUINO
+// Put the water through the flow meter since the last time down to the zones that are on, once a loop
+void ShareFlow();
+#endif
+#ifdef SIMULATOR
+// Called whenever a zone's run is logged, with the litres the flow meter put down to it or -1
+void SimZoneLogged(int16_t zone, long duration, float volume);
+#endif
 void ClearEvents();
+int BuildZoneRuns(const Schedule & sched, long start_time, ZoneRun * runs, int max_runs);
 void LoadSchedTimeEvents(uint8_t sched_num, bool bQuickSchedule = false);
 void ReloadEvents(bool bAllEvents = false);
+void ReloadStartEvents();
+void ScheduleChanged(uint8_t sched_num);
+void ScheduleDeleted(uint8_t sched_num);
+void BuildPlan(const TimeContext & now, int days, bool bWeather, PlanCallback callback, void * context);
+int16_t GetLastWeatherScale();
+void ProjectDurations(Schedule * sched, bool bWeather);
 bool isZoneOn(int iNum);
 void TurnOnZone(int iValve);
+void OpenZone(int iValve);
+void CloseZone(int iValve);
 void TurnOffZones();
 void io_setup();
 void io_latchNow();
 
+// The schedule number a quick schedule runs as, as it doesn't have a slot.  It's logged as schedule 0.
+#define QUICK_SCHEDULE 255
+
 class runStateClass
 {
 public:
@@ -43,9 +90,11 @@ public:
 	};
 public:
 	runStateClass();
-	void SetSchedule(bool val, int8_t iSchedNum = -1, const runStateClass::DurationAdjustments * adj = 0);
-	void ContinueSchedule(int8_t zone, short endTime);
-	void SetManual(bool val, int8_t zone = -1);
+	void SetSchedule(bool val, int16_t iSchedNum = -1, const runStateClass::DurationAdjustments * adj = 0);
+	void ContinueSchedule(int16_t zone, long endTime);
+	void StartZone(int16_t zone, long endTime);
+	void EndZone(int16_t zone);
+	void SetManual(bool val, int16_t zone = -1);
 	bool isSchedule()
 	{
 		return m_bSchedule;
@@ -54,26 +103,48 @@ public:
 	{
 		return m_bManual;
 	}
-	int8_t getZone()
+	int16_t getZone()
 	{
 		return m_zone;
 	}
-	short getEndTime()
+	int16_t getSchedule()
+	{
+		return m_iSchedule;
+	}
+	// the running schedule has moved to a new slot
+	void RenumberSchedule(int16_t iSchedNum)
+	{
+		m_iSchedule = iSchedNum;
+	}
+	// seconds past local midnight that the current zone turns off
+	long getEndTime()
 	{
 		return m_endTime;
 	}
+	// zones that are on, and so sharing the water through the flow meter
+	int ZonesOn();
+	// litres that have gone through each zone that's on
+	void AddVolume(float litres);
 private:
 	void LogSchedule();
+	void LogZone(int16_t zone, time_t timeNow);
+	// litres through the zone this run, -1 without a flow meter
+	float ZoneVolume(int16_t zone);
 	bool m_bSchedule;
 	bool m_bManual;
-	int8_t m_iSchedule;
-	int8_t m_zone;
-	short m_endTime;
-	time_t m_eventTime;
+	int16_t m_iSchedule;
+	int16_t m_zone;
+	long m_endTime;
+	// when each zone (1..NUM_ZONES) was turned on, 0 if it is off
+	time_t m_zoneStart[NUM_ZONES + 1];
+	long m_zoneEnd[NUM_ZONES + 1];
+	// litres through each zone that's on since it was turned on
+	float m_zoneVolume[NUM_ZONES + 1];
 	DurationAdjustments m_adj;
 };
 
-extern runStateClass runState;
+// the time for the current pass of the main loop
+extern TimeContext tickTime;
 extern nntp nntpTimeServer;
 
 #endif
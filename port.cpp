@@ -6,8 +6,10 @@
 //
 
 #include "port.h"
+#include "settings.h"
 #include <stdarg.h>
 #include <stdio.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -18,11 +20,21 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+
+// Settings changes are written this long after the last of them, but held back no longer than
+//  STORE_MAX_DELAY_MS however they keep coming
+#define STORE_DEBOUNCE_MS 2000
+#define STORE_MAX_DELAY_MS 10000
+
+static SystemClock systemClock;
+Clock * sysClock = &systemClock;
+
 void trace(const char * fmt, ...)
 {
-	time_t curTime = time(0);
-	struct tm * ti = localtime (&curTime);
-	printf("%.4d/%.2d/%.2d %.2d:%.2d:%.2d ", 1900 + ti->tm_year, ti->tm_mon+1, ti->tm_mday, ti->tm_hour, ti->tm_min, ti->tm_sec);
+	time_t curTime = sysClock->utcNow();
+	struct tm ti;
+	localtime_r(&curTime, &ti);
+	printf("%.4d/%.2d/%.2d %.2d:%.2d:%.2d ", 1900 + ti.tm_year, ti.tm_mon+1, ti.tm_mday, ti.tm_hour, ti.tm_min, ti.tm_sec);
 	va_list parms;
 	va_start(parms, fmt);
 	vprintf(fmt, parms);
@@ -30,6 +42,13 @@ void trace(const char * fmt, ...)
 	fflush(stdout);
 }
 
+long NowMs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
 IPAddress::IPAddress()
 {
 	_address[0] = 0;
@@ -46,48 +65,176 @@ IPAddress::IPAddress(uint8_t first_octet, uint8_t second_octet, uint8_t third_oc
 	_address[3] = fourth_octet;
 }
 
-EEPROMClass::EEPROMClass()
-		: m_changed(false)
+// The whole settings file is taken in with one read.  One from before the settings were kept as records
+//  is the EEPROM image itself, and is kept as it is so IsFirstBoot can update it.  It's written back out
+//  as records the first time round the main loop.
+EEPROMClass::EEPROMClass(const char * dir)
+		: m_buf(0), m_size(0), m_changed(false), m_bPending(false), m_firstChange(0), m_lastChange(0), m_writes(0), m_bytesWritten(0)
 {
-	memset(m_buf, 0, sizeof(m_buf));
-	FILE * fd = fopen("settings", "rb");
-	if (!fd)
+	// left empty, so nothing's read or written, rather than cut short and somewhere else
+	if (snprintf(m_path, sizeof(m_path), "%ssettings", dir) >= (int) sizeof(m_path))
+	{
+		trace("Settings directory %s is too long, not keeping the settings\n", dir);
+		m_path[0] = 0;
+	}
+	uint8_t * file = 0;
+	long len = 0;
+	FILE * fd = fopen(m_path, "rb");
+	if (fd)
+	{
+		if ((fseek(fd, 0, SEEK_END) == 0) && ((len = ftell(fd)) > 0))
+		{
+			rewind(fd);
+			file = new uint8_t[len];
+			len = fread(file, 1, len, fd);
+		}
+		if (len <= 0)
+			trace("Warning: no bytes read when loading EEPROM.\n");
+		fclose(fd);
+	}
+	if (IsSettingsFile(file, len))
+	{
+		m_size = DecodeSettings(file, len, &m_buf);
+		delete [] file;
 		return;
-	auto bytes = fread(m_buf, 1, sizeof(m_buf), fd);
-	if (!bytes)
-		trace("Warning: no bytes read when loading EEPROM.\n");
-	fclose(fd);
+	}
+	m_size = spi_max((long)EEPROM_SIZE, len);
+	m_buf = new uint8_t[m_size];
+	memset(m_buf, 0, m_size);
+	if (len > 0)
+	{
+		memcpy(m_buf, file, len);
+		m_changed = true;
+	}
+	delete [] file;
 }
 
 EEPROMClass::~EEPROMClass()
 {
+	delete [] m_buf;
 }
 
+// Past the end reads as 0, which is what's there in a settings file written with fewer zones or schedules
 uint8_t EEPROMClass::read(int addr)
 {
+	if ((addr < 0) || (addr >= m_size))
+		return 0;
 	return m_buf[addr];
 }
 
 void EEPROMClass::write(int addr, uint8_t val)
 {
+	if (addr < 0)
+		return;
+	if (addr >= m_size)
+		Grow(addr + 1);
 	m_buf[addr] = val;
 	m_changed = true;
 }
 
+void EEPROMClass::read(int addr, void * data, int len)
+{
+	memset(data, 0, len);
+	if ((addr < 0) || (addr >= m_size))
+		return;
+	memcpy(data, m_buf + addr, spi_min(len, m_size - addr));
+}
+
+void EEPROMClass::write(int addr, const void * data, int len)
+{
+	if (addr < 0)
+		return;
+	if (addr + len > m_size)
+		Grow(addr + len);
+	memcpy(m_buf + addr, data, len);
+	m_changed = true;
+}
+
+// Doubling, so a run of writes past the end only copies the image a few times
+void EEPROMClass::Grow(int size)
+{
+	int new_size = m_size;
+	while (new_size < size)
+		new_size *= 2;
+	uint8_t * buf = new uint8_t[new_size];
+	memcpy(buf, m_buf, m_size);
+	memset(buf + m_size, 0, new_size - m_size);
+	delete [] m_buf;
+	m_buf = buf;
+	m_size = new_size;
+}
+
 void EEPROMClass::Store()
 {
+	if (!m_changed && !m_bPending)
+		return;
+	const long now = NowMs();
 	if (m_changed)
 	{
 		m_changed = false;
-		FILE * fd = fopen("settings", "wb");
-		if (!fd)
-			return trace("Failed to open settings file\n");
-		fwrite(m_buf, 1, sizeof(m_buf), fd);
-		fclose(fd);
+		if (!m_bPending)
+			m_firstChange = now;
+		m_bPending = true;
+		m_lastChange = now;
 	}
+	if ((now - m_lastChange < STORE_DEBOUNCE_MS) && (now - m_firstChange < STORE_MAX_DELAY_MS))
+		return;
+	if (Write())
+		m_bPending = false;
+	else
+		// try again in a while rather than every pass
+		m_firstChange = m_lastChange = now;
+}
+
+void EEPROMClass::Flush()
+{
+	if ((m_changed || m_bPending) && Write())
+		m_changed = m_bPending = false;
 }
 
-EEPROMClass EEPROM;
+// Written to a new file that's then renamed over the old one, so a crash or power cut part way through
+//  leaves the old settings rather than half of the new ones.
+bool EEPROMClass::Write()
+{
+	if (!m_path[0])
+		return false;
+	char tmp_path[sizeof(m_path) + 4];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", m_path);
+	const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		trace("Failed to open settings file (%s)\n", strerror(errno));
+		return false;
+	}
+	uint8_t * file;
+	const long len = EncodeSettings(m_buf, m_size, &file);
+	long done = 0;
+	ssize_t ret = 0;
+	while ((done < len) && ((ret = ::write(fd, file + done, len - done)) > 0))
+		done += ret;
+	delete [] file;
+	bool bOK = (done == len) && (fsync(fd) == 0);
+	bOK = (close(fd) == 0) && bOK;
+	if (!bOK || (rename(tmp_path, m_path) != 0))
+	{
+		trace("Failed to write settings file (%s)\n", strerror(errno));
+		unlink(tmp_path);
+		return false;
+	}
+	// and the rename itself is only on the disk once the directory is
+	char dir[sizeof(m_path)];
+	const char * slash = strrchr(m_path, '/');
+	snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - m_path) : 1, slash ? m_path : ".");
+	const int dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd >= 0)
+	{
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+	m_writes++;
+	m_bytesWritten += len;
+	return true;
+}
 
 EthernetServer::EthernetServer(uint16_t port)
 		: m_port(port), m_sock(0)
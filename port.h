@@ -7,6 +7,7 @@
 
 #ifndef _SP_PORT_H_
 #define _SP_PORT_H_
+#include "config.h"
 #include <stdio.h>
 #include <inttypes.h>
 #include <ctype.h>
@@ -15,6 +16,8 @@
 #define fprintf_P fprintf
 
 void trace(const char * fmt, ...);
+// milliseconds on a clock that only goes forward, for timing waits and latencies
+long NowMs();
 
 #ifndef spi_max
 #define spi_max(a,b) (((a) > (b)) ? (a) : (b))
@@ -51,42 +54,88 @@ public:
 	;
 };
 
+// The settings, kept in memory the way they were laid out in the Arduino's EEPROM.  On disk they're
+//  a file of tagged records, see EncodeSettings in settings.h.
 class EEPROMClass
 {
 public:
-	EEPROMClass();
+	// the settings file is kept in dir, "" for the working directory
+	EEPROMClass(const char * dir = "");
 	~EEPROMClass();
 	uint8_t read(int addr);
 	void write(int addr, uint8_t);
+	// copy len bytes out of or into the image
+	void read(int addr, void * data, int len);
+	void write(int addr, const void * data, int len);
+	// Called every pass of the main loop.  Writes the settings file once the changes have stopped for
+	//  STORE_DEBOUNCE_MS, or STORE_MAX_DELAY_MS after the first, so a burst of edits is one write.
 	void Store();
+	// Write any changes now, e.g. before exiting
+	void Flush();
+	// times the settings file has been written and the bytes written, to keep an eye on SD card wear
+	uint32_t Writes() const { return m_writes; }
+	uint64_t BytesWritten() const { return m_bytesWritten; }
 private:
-	uint8_t m_buf[2048];
+	void Grow(int size);
+	bool Write();
+	// at least EEPROM_SIZE bytes (see settings.h), and grows as schedules are added
+	uint8_t * m_buf;
+	int m_size;
 	bool m_changed;
+	// changes waiting to be written, and when the first and last were seen in milliseconds
+	bool m_bPending;
+	long m_firstChange;
+	long m_lastChange;
+	uint32_t m_writes;
+	uint64_t m_bytesWritten;
+	char m_path[CONTROLLER_DIR_SIZE + sizeof("settings")];
 };
 
-extern EEPROMClass EEPROM;
-
 const IPAddress INADDR_NONE(0, 0, 0, 0);
 
 #include <time.h>
+
+// Where the current time comes from.  Normally the system clock, but the simulator
+//  installs a virtual clock so it can run through days of schedules in seconds.
+class Clock
+{
+public:
+	virtual ~Clock() {}
+	virtual time_t utcNow() = 0;
+};
+
+class SystemClock : public Clock
+{
+public:
+	time_t utcNow()
+	{
+		return time(0);
+	}
+};
+
+// The clock everything reads the time from.
+extern Clock * sysClock;
+
 class nntp
 {
 public:
 	time_t LocalNow()
 	{
-		time_t t = time(0);
-		struct tm * ti = localtime(&t);
-		return t + ti->tm_gmtoff;
+		time_t t = sysClock->utcNow();
+		struct tm ti;
+		localtime_r(&t, &ti);
+		return t + ti.tm_gmtoff;
 	}
     int LocalHour()
     {
-        time_t t = time(0);
-        struct tm * ti = localtime(&t);
-        return ti->tm_hour;
+        time_t t = sysClock->utcNow();
+        struct tm ti;
+        localtime_r(&t, &ti);
+        return ti.tm_hour;
     }
     time_t utcNow()
     {
-        return time(0);
+        return sysClock->utcNow();
     }
 	void checkTime()
 	{
@@ -94,7 +143,7 @@ public:
 };
 static inline time_t now()
 {
-	return time(0);
+	return sysClock->utcNow();
 }
 
 // time manipulation functions
@@ -108,60 +157,93 @@ static inline time_t now()
 #define elapsedDays(_time_) ( _time_ / SECS_PER_DAY)  // this is number of days since Jan 1 1970
 static inline int hour(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_hour;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_hour;
 }
 
 static inline int minute(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_min;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_min;
 }
 
 static inline int second(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_sec;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_sec;
 }
 
 static inline int year(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_year + 1900;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_year + 1900;
 }
 
 static inline int month(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_mon + 1;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_mon + 1;
 }
 
 static inline int day(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_mday;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_mday;
 }
 
 static inline int mday(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_mday;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_mday;
 }
 
 static inline int weekday(time_t t)
 {
-	struct tm * ptm;
-	ptm = gmtime(&t);
-	return ptm->tm_wday + 1;
+	struct tm ti;
+	gmtime_r(&t, &ti);
+	return ti.tm_wday + 1;
 }
 
+// The time for one pass of the main loop.  It's worked out once at the start of the pass, so the
+//  scheduler and the web pages all agree on the time and don't each go back to localtime for it.
+struct TimeContext
+{
+	time_t utc;
+	time_t local;		// local time, as seconds since 1970
+	long offset;		// seconds local time is ahead of UTC
+	long day;			// local days since Jan 1 1970
+	long seconds;		// seconds past local midnight
+	int minutes;		// minutes past local midnight
+	int hour;
+	int weekday;		// 1 is Sunday
+	int mday;
+	int month;
+	int year;
+	void Set(time_t utc_now)
+	{
+		struct tm ti;
+		localtime_r(&utc_now, &ti);
+		utc = utc_now;
+		offset = ti.tm_gmtoff;
+		local = utc_now + offset;
+		day = elapsedDays(local);
+		seconds = local - previousMidnight(local);
+		minutes = seconds / 60;
+		hour = ti.tm_hour;
+		weekday = ti.tm_wday + 1;
+		mday = ti.tm_mday;
+		month = ti.tm_mon + 1;
+		year = ti.tm_year + 1900;
+	}
+};
+
 class EthernetServer;
 
 class EthernetClient
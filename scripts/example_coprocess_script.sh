@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# This script is kept running when the "Script" output type is selected.  It's given the
+# number of zones and the controller number, then a line for each change of the outputs:
+#
+#   <sequence number> <outputs in hex, bit 0 the pump and bit n zone n>
+#
+# It logs each change to /tmp/zone.log, passes the outputs through to the command line
+# version of wiringpi, then writes the sequence number back to say it's done.
+# To use, copy this script to /usr/local/bin/sprinklers_pi_coprocess and
+# make sure it is executable with "chmod +x /usr/local/bin/sprinklers_pi_coprocess"
+
+zones=$1
+while read seq outputs; do
+	echo "SEQ: $seq OUTPUTS: $outputs" >> /tmp/zone.log
+	for ((i = 0; i <= zones; i++)); do
+		# one hex digit at a time, as there can be more outputs than fit in a number
+		digit=${outputs:$(( ${#outputs} - 1 - i / 4 )):1}
+		gpio write $i $(( (16#$digit >> (i % 4)) & 1 ))
+	done
+	echo "$seq"
+done
@@ -5,6 +5,7 @@
 //
 
 #include "settings.h"
+#include "Controller.h"
 #include "port.h"
 #include <string.h>
 #include <stdlib.h>
@@ -16,48 +17,77 @@ Schedule::Schedule() : m_type(0), day(0)
 		time[i] = -1;
 	for (uint8_t i=0; i<sizeof(zone_duration)/sizeof(zone_duration[0]); i++)
 		zone_duration[i] = 0;
+	memset(&cron, 0, sizeof(cron));
 }
 
 void LoadSchedule(uint8_t num, Schedule * pSched)
 {
 	if (num < 0 || num >= MAX_SCHEDULES)
 		return;
-	for (uint8_t i = 0; i < sizeof(Schedule); ++i)
-	{
-		*(((char*) pSched) + i) = EEPROM.read(SCHEDULE_OFFSET + i + SCHEDULE_INDEX * num);
-	}
+	controller->m_eeprom.read(SCHEDULE_OFFSET + SCHEDULE_INDEX * num, pSched, sizeof(Schedule));
 }
 
 void SaveSchedule(uint8_t num, const Schedule * pSched)
 {
 	if (num < 0 || num >= MAX_SCHEDULES)
 		return;
-	for (uint8_t i = 0; i < sizeof(Schedule); i++)
-		EEPROM.write(SCHEDULE_OFFSET + i + SCHEDULE_INDEX * num, *((char*) pSched + i));
+	controller->m_eeprom.write(SCHEDULE_OFFSET + SCHEDULE_INDEX * num, pSched, sizeof(Schedule));
 }
 
 void LoadZone(uint8_t num, FullZone * pZone)
 {
 	if (num < 0 || num >= NUM_ZONES)
 		return;
-	for (uint8_t i = 0; i < sizeof(FullZone); i++)
-		*((char*) pZone + i) = EEPROM.read(ZONE_OFFSET + i + ZONE_INDEX * num);
+	controller->m_eeprom.read(ZONE_OFFSET + ZONE_INDEX * num, pZone, sizeof(FullZone));
 }
 
 void SaveZone(uint8_t num, const FullZone * pZone)
 {
 	if (num < 0 || num >= NUM_ZONES)
 		return;
-	for (uint8_t i = 0; i < sizeof(FullZone); i++)
-		EEPROM.write(ZONE_OFFSET + i + ZONE_INDEX * num, *((char*) pZone + i));
+	controller->m_eeprom.write(ZONE_OFFSET + ZONE_INDEX * num, pZone, sizeof(FullZone));
 }
 
 void LoadShortZone(uint8_t num, ShortZone * pZone)
 {
 	if (num < 0 || num >= NUM_ZONES)
 		return;
-	for (uint8_t i = 0; i < sizeof(ShortZone); i++)
-		*((char*) pZone + i) = EEPROM.read(ZONE_OFFSET + i + ZONE_INDEX * num);
+	controller->m_eeprom.read(ZONE_OFFSET + ZONE_INDEX * num, pZone, sizeof(ShortZone));
+}
+
+int ParseZoneKey(const char * key, const char ** pRest)
+{
+	if (key[0] != 'z')
+		return -1;
+	int zone = -1;
+	const char * rest = key + 2;
+	if (isdigit(key[1]))
+	{
+		char * end;
+		zone = strtol(key + 1, &end, 10) - 1;
+		rest = end;
+	}
+	else if ((key[1] >= 'b') && (key[1] <= 'a' + spi_min(NUM_ZONES, LEGACY_ZONES)))
+		zone = key[1] - 'b';
+	if ((zone < 0) || (zone >= NUM_ZONES))
+		return -1;
+	if (pRest)
+		*pRest = rest;
+	return zone;
+}
+
+// Decode a zone duration given in minutes, either as a (possibly fractional) number
+//  of minutes (e.g. "6.5") or as minutes and seconds (e.g. "6:30").  Returns seconds.
+uint16_t ParseDuration(const char * value)
+{
+	char * pEnd;
+	double minutes = strtod(value, &pEnd);
+	if (*pEnd == ':')
+		minutes = (long)minutes + strtod(pEnd + 1, NULL) / 60.0;
+	const double seconds = minutes * 60.0 + 0.5;
+	if (seconds < 1.0)
+		return 0;
+	return (uint16_t)spi_min(seconds, 65535.0);
 }
 
 // Decode an IP address in dotted decimal format.
@@ -86,7 +116,7 @@ static IPAddress decodeIP(const char * value)
 // Qualifier:
 // Parameter: const KVPairs & key_value_pairs
 //************************************
-bool SetSchedule(const KVPairs & key_value_pairs)
+bool SetSchedule(const KVPairs & key_value_pairs, int * pSchedNum)
 {
 	freeMemory();
 	Schedule sched;
@@ -97,6 +127,8 @@ bool SetSchedule(const KVPairs & key_value_pairs)
 	sched.time[2] = -1;
 	sched.time[3] = -1;
 	bool time_enable[4] = {0};
+	int zone;
+	const char * rest;
 
 	// Iterate through the kv pairs and update the appropriate structure values.
 	for (int i = 0; i < key_value_pairs.num_pairs; i++)
@@ -117,6 +149,15 @@ bool SetSchedule(const KVPairs & key_value_pairs)
 			sched.SetRestriction((uint8_t)atoi(value));
 		else if (strcmp(key, "name") == 0)
 			strncpy(sched.name, value, sizeof(sched.name));
+		else if ((strcmp(key, "cron") == 0) && (value[0] != 0))
+		{
+			if (!sched.cron.Parse(value))
+			{
+				trace(F("Invalid Cron Expression\n"));
+				return false;
+			}
+			sched.SetCron(true);
+		}
 		else if (strcmp(key, "interval") == 0)
 		{
 			if (sched.IsInterval())
@@ -132,7 +173,18 @@ bool SetSchedule(const KVPairs & key_value_pairs)
 		else if ((key[0] == 't') && (key[2] == 0) && ((key[1] >= '1') && (key[1] <= '4')))
 		{
 			const char * colon_loc = strstr(value, ":");
-			if ((uint64_t)colon_loc > 0)
+			// SR or SS, with an optional offset in minutes, e.g. SR-30 or SS+15
+			if ((toupper(value[0]) == 'S') && ((toupper(value[1]) == 'R') || (toupper(value[1]) == 'S')))
+			{
+				const int offset = strtol(value + 2, NULL, 10);
+				if ((offset > MAX_SOLAR_OFFSET) || (offset < -MAX_SOLAR_OFFSET))
+				{
+					trace(F("Invalid Sun Offset\n"));
+					return false;
+				}
+				sched.time[key[1] - '1'] = ((toupper(value[1]) == 'R') ? TIME_SUNRISE : TIME_SUNSET) | (offset + TIME_OFFSET_BIAS);
+			}
+			else if ((uint64_t)colon_loc > 0)
 			{
 				int hour = strtol(value, NULL, 10);
 				int minute = strtol(colon_loc + 1, NULL, 10);
@@ -154,9 +206,9 @@ bool SetSchedule(const KVPairs & key_value_pairs)
 			else
 				time_enable[key[1] - '1'] = false;
 		}
-		else if ((key[0] == 'z') && (key[2] == 0) && ((key[1] >= 'b') && (key[1] <= ('a' + NUM_ZONES))))
+		else if (((zone = ParseZoneKey(key, &rest)) != -1) && (*rest == 0))
 		{
-			sched.zone_duration[key[1] - 'b'] = atoi(value);
+			sched.zone_duration[zone] = ParseDuration(value);
 		}
 	}
 
@@ -189,10 +241,12 @@ bool SetSchedule(const KVPairs & key_value_pairs)
 	}
 	// and save it
 	SaveSchedule(sched_num, &sched);
+	if (pSchedNum)
+		*pSchedNum = sched_num;
 	return true;
 }
 
-bool DeleteSchedule(const KVPairs & key_value_pairs)
+bool DeleteSchedule(const KVPairs & key_value_pairs, int * pSchedNum)
 {
 	int sched_num = -1;
 	// Iterate through the kv pairs and update the appropriate structure values.
@@ -220,9 +274,17 @@ bool DeleteSchedule(const KVPairs & key_value_pairs)
 		SaveSchedule(i, &sched);
 	}
 	SetNumSchedules(iNumSchedules - 1);
+	if (pSchedNum)
+		*pSchedNum = sched_num;
 	return true;
 }
 
+// The fields a zone save sends for every zone.  NUM_KEY_VALUES makes room for ZONE_KEY_VALUES of them a
+//  zone, so a field added here without raising that would drop the later zones' pairs.
+enum {ZF_NAME, ZF_ENABLED, ZF_PUMP, ZF_FLOW, ZF_CYCLE, ZF_SOAK, ZF_COUNT};
+static const char * const zoneFields[ZF_COUNT] = {"name", "e", "p", "f", "c", "s"};
+static_assert(ZF_COUNT <= ZONE_KEY_VALUES, "ZONE_KEY_VALUES (web.h) doesn't leave room for every zone field");
+
 bool SetZones(const KVPairs & key_value_pairs)
 {
 	FullZone zones[NUM_ZONES] = {0};
@@ -231,25 +293,33 @@ bool SetZones(const KVPairs & key_value_pairs)
 	{
 		const char * key = key_value_pairs.keys[i];
 		const char * value = key_value_pairs.values[i];
-		if ((key[0] == 'z') && (key[1] >= 'b') && (key[1] <= ('a' + NUM_ZONES)))
+		const char * field;
+		const int zone_num = ParseZoneKey(key, &field);
+		if (zone_num == -1)
+			continue;
+		int f = 0;
+		while ((f < ZF_COUNT) && (strcmp(field, zoneFields[f]) != 0))
+			f++;
+		switch (f)
 		{
-			int zone_num = key[1] - 'b';
-			if (memcmp(key + 2, "name", 5) == 0)
-				strncpy(zones[zone_num].name, value, sizeof(zones[zone_num].name));
-			else if ((key[2] == 'e') && (key[3] == 0))
-			{
-				if (strcmp(value, "on") == 0)
-					zones[zone_num].bEnabled = true;
-				else
-					zones[zone_num].bEnabled = false;
-			}
-			else if ((key[2] == 'p') && (key[3] == 0))
-			{
-				if (strcmp(value, "on") == 0)
-					zones[zone_num].bPump = true;
-				else
-					zones[zone_num].bPump = false;
-			}
+		case ZF_NAME:
+			strncpy(zones[zone_num].name, value, sizeof(zones[zone_num].name));
+			break;
+		case ZF_ENABLED:
+			zones[zone_num].bEnabled = (strcmp(value, "on") == 0);
+			break;
+		case ZF_PUMP:
+			zones[zone_num].bPump = (strcmp(value, "on") == 0);
+			break;
+		case ZF_FLOW:
+			zones[zone_num].flow = spi_min(strtoul(value, 0, 10), 255UL);
+			break;
+		case ZF_CYCLE:
+			zones[zone_num].cycle = spi_min(strtoul(value, 0, 10), 255UL);
+			break;
+		case ZF_SOAK:
+			zones[zone_num].soak = spi_min(strtoul(value, 0, 10), 255UL);
+			break;
 		}
 	}
 	for (int i = 0; i < NUM_ZONES; i++)
@@ -327,18 +397,23 @@ bool SetSettings(const KVPairs & key_value_pairs)
 		{
 			SetUsePWS(strcmp(value, "pws") == 0);
 		}
+		else if (strcmp(key, "cap") == 0)
+		{
+			SetFlowCapacity(spi_min(strtoul(value, 0, 10), 255UL));
+		}
 
 	}
 	return true;
 }
 
-static const char * const sHeader = "S1.2";
+static const char * const sHeader = "S1.4";
 void ResetEEPROM()
 {
 	trace(F("Reseting EEPROM\n"));
 	for (int i = 0; i <= 3; i++)
-		EEPROM.write(i, sHeader[i]);
+		controller->m_eeprom.write(i, sHeader[i]);
 	SetNumSchedules(0);
+	controller->m_eeprom.write(ADDR_ZONE_LAYOUT, (NUM_ZONES > LEGACY_ZONES) ? NUM_ZONES : 0);
 	FullZone zone = {0};
 	for (int i = 0; i < NUM_ZONES; i++)
 	{
@@ -363,153 +438,164 @@ void ResetEEPROM()
 	SetPWS("");
 	SetLoc("");
 	SetUsePWS(false);
+	SetFlowCapacity(0);
 	SetOT(OT_NONE);
 }
 
 void SetNumSchedules(const uint8_t iNum)
 {
-	EEPROM.write(ADDR_SCHEDULE_COUNT, iNum);
+	controller->m_eeprom.write(ADDR_SCHEDULE_COUNT, iNum);
 }
 
+// A settings file from a build allowing more schedules only has the first MAX_SCHEDULES of them used
 uint8_t GetNumSchedules()
 {
-	return EEPROM.read(ADDR_SCHEDULE_COUNT);
+	return spi_min(controller->m_eeprom.read(ADDR_SCHEDULE_COUNT), MAX_SCHEDULES);
 }
 
 void SetNTPOffset(const int8_t value)
 {
-	EEPROM.write(ADDR_NTP_OFFSET, value);
+	controller->m_eeprom.write(ADDR_NTP_OFFSET, value);
 }
 
 int8_t GetNTPOffset()
 {
-	return EEPROM.read(ADDR_NTP_OFFSET);
+	return controller->m_eeprom.read(ADDR_NTP_OFFSET);
+}
+
+// The four bytes of an address at addr
+static IPAddress ReadIP(int addr)
+{
+	EEPROMClass & eeprom = controller->m_eeprom;
+	return IPAddress(eeprom.read(addr), eeprom.read(addr + 1), eeprom.read(addr + 2), eeprom.read(addr + 3));
 }
 
 IPAddress GetNTPIP()
 {
-	return IPAddress(EEPROM.read(ADDR_NTP_IP), EEPROM.read(ADDR_NTP_IP + 1), EEPROM.read(ADDR_NTP_IP + 2), EEPROM.read(ADDR_NTP_IP + 3));
+	return ReadIP(ADDR_NTP_IP);
 }
 
 void SetNTPIP(const IPAddress & value)
 {
 	for (int i = 0; i < 4; i++)
-		EEPROM.write(ADDR_NTP_IP + i, value[i]);
+		controller->m_eeprom.write(ADDR_NTP_IP + i, value[i]);
 }
 
 IPAddress GetIP()
 {
-	return IPAddress(EEPROM.read(ADDR_IP), EEPROM.read(ADDR_IP + 1), EEPROM.read(ADDR_IP + 2), EEPROM.read(ADDR_IP + 3));
+	return ReadIP(ADDR_IP);
 }
 
 void SetIP(const IPAddress & value)
 {
 	for (int i = 0; i < 4; i++)
-		EEPROM.write(ADDR_IP + i, value[i]);
+		controller->m_eeprom.write(ADDR_IP + i, value[i]);
 }
 
 IPAddress GetNetmask()
 {
-	return IPAddress(EEPROM.read(ADDR_NETMASK), EEPROM.read(ADDR_NETMASK + 1), EEPROM.read(ADDR_NETMASK + 2), EEPROM.read(ADDR_NETMASK + 3));
+	return ReadIP(ADDR_NETMASK);
 }
 
 void SetNetmask(const IPAddress & value)
 {
 	for (int i = 0; i < 4; i++)
-		EEPROM.write(ADDR_NETMASK + i, value[i]);
+		controller->m_eeprom.write(ADDR_NETMASK + i, value[i]);
 }
 
 IPAddress GetGateway()
 {
-	return IPAddress(EEPROM.read(ADDR_GATEWAY), EEPROM.read(ADDR_GATEWAY + 1), EEPROM.read(ADDR_GATEWAY + 2), EEPROM.read(ADDR_GATEWAY + 3));
+	return ReadIP(ADDR_GATEWAY);
 }
 
 void SetGateway(const IPAddress & value)
 {
 	for (int i = 0; i < 4; i++)
-		EEPROM.write(ADDR_GATEWAY + i, value[i]);
+		controller->m_eeprom.write(ADDR_GATEWAY + i, value[i]);
 }
 
 IPAddress GetWUIP()
 {
-	return IPAddress(EEPROM.read(ADDR_WUIP), EEPROM.read(ADDR_WUIP + 1), EEPROM.read(ADDR_WUIP + 2), EEPROM.read(ADDR_WUIP + 3));
+	return ReadIP(ADDR_WUIP);
 }
 
 void SetWUIP(const IPAddress & value)
 {
 	for (int i = 0; i < 4; i++)
-		EEPROM.write(ADDR_WUIP + i, value[i]);
+		controller->m_eeprom.write(ADDR_WUIP + i, value[i]);
 }
 
 uint32_t GetZip()
 {
-	return (uint32_t) EEPROM.read(ADDR_ZIP) << 24 | (uint32_t) EEPROM.read(ADDR_ZIP + 1) << 16 | (uint32_t) EEPROM.read(ADDR_ZIP + 2) << 8
-			| (uint32_t) EEPROM.read(ADDR_ZIP + 3);
+	EEPROMClass & eeprom = controller->m_eeprom;
+	return (uint32_t) eeprom.read(ADDR_ZIP) << 24 | (uint32_t) eeprom.read(ADDR_ZIP + 1) << 16 | (uint32_t) eeprom.read(ADDR_ZIP + 2) << 8
+			| (uint32_t) eeprom.read(ADDR_ZIP + 3);
 }
 
 void SetZip(const uint32_t zip)
 {
 	for (int i = 0; i < 4; i++)
-		EEPROM.write(ADDR_ZIP + i, zip >> (8 * (3 - i)));
+		controller->m_eeprom.write(ADDR_ZIP + i, zip >> (8 * (3 - i)));
 }
 
 void GetPWS(char * val)
 {
 	for (int i=0; i<LEN_PWS; i++)
-		val[i] = EEPROM.read(ADDR_PWS+i);
+		val[i] = controller->m_eeprom.read(ADDR_PWS+i);
 	val[LEN_PWS] = 0;
 }
 
 void SetPWS(const char * val)
 {
 	for (int i=0; i<LEN_PWS; i++)
-		EEPROM.write(ADDR_PWS+i, val[i]);
+		controller->m_eeprom.write(ADDR_PWS+i, val[i]);
 }
 
 void GetApiId(char * val)
 {
 	for (int i=0; i<LEN_APIID; i++)
-		val[i] = EEPROM.read(ADDR_APIID+i);
+		val[i] = controller->m_eeprom.read(ADDR_APIID+i);
 	val[LEN_APIID] = 0;
 }
 
 void SetApiId(const char * val)
 {
 	for (int i=0; i<LEN_APIID; i++)
-		EEPROM.write(ADDR_APIID+i, val[i]);
+		controller->m_eeprom.write(ADDR_APIID+i, val[i]);
 }
 
 void GetApiSecret(char * val)
 {
 	for (int i=0; i<LEN_APISECRET; i++)
-		val[i] = EEPROM.read(ADDR_APISECRET+i);
+		val[i] = controller->m_eeprom.read(ADDR_APISECRET+i);
 	val[LEN_APISECRET] = 0;
 }
 
 void SetApiSecret(const char * val)
 {
 	for (int i=0; i<LEN_APISECRET; i++)
-		EEPROM.write(ADDR_APISECRET+i, val[i]);
+		controller->m_eeprom.write(ADDR_APISECRET+i, val[i]);
 }
 
 void GetLoc(char * val)
 {
 	for (int i=0; i<LEN_LOC; i++)
-		val[i] = EEPROM.read(ADDR_LOC+i);
+		val[i] = controller->m_eeprom.read(ADDR_LOC+i);
 	val[LEN_LOC] = 0;
 }
 
 void SetLoc(const char * val)
 {
 	for (int i=0; i<LEN_LOC; i++)
-		EEPROM.write(ADDR_LOC+i, val[i]);
+		controller->m_eeprom.write(ADDR_LOC+i, val[i]);
 }
 
 void GetApiKey(char * key)
 {
-	sprintf(key, "%02x%02x%02x%02x%02x%02x%02x%02x", EEPROM.read(ADDR_APIKEY), EEPROM.read(ADDR_APIKEY + 1), EEPROM.read(ADDR_APIKEY + 2),
-			EEPROM.read(ADDR_APIKEY + 3), EEPROM.read(ADDR_APIKEY + 4), EEPROM.read(ADDR_APIKEY + 5), EEPROM.read(ADDR_APIKEY + 6),
-			EEPROM.read(ADDR_APIKEY + 7));
+	EEPROMClass & eeprom = controller->m_eeprom;
+	sprintf(key, "%02x%02x%02x%02x%02x%02x%02x%02x", eeprom.read(ADDR_APIKEY), eeprom.read(ADDR_APIKEY + 1), eeprom.read(ADDR_APIKEY + 2),
+			eeprom.read(ADDR_APIKEY + 3), eeprom.read(ADDR_APIKEY + 4), eeprom.read(ADDR_APIKEY + 5), eeprom.read(ADDR_APIKEY + 6),
+			eeprom.read(ADDR_APIKEY + 7));
 }
 
 static uint8_t toHex(char val)
@@ -529,58 +615,58 @@ void SetApiKey(const char * key)
 	if (strlen(key) != 16)
 	{
 		for (int i = 0; i < 8; i++)
-			EEPROM.write(ADDR_APIKEY + i, 0);
+			controller->m_eeprom.write(ADDR_APIKEY + i, 0);
 	}
 	else
 	{
 		for (int i = 0; i < 8; i++)
 		{
-			EEPROM.write(ADDR_APIKEY + i, (toHex(key[i * 2]) << 4) | toHex(key[i * 2 + 1]));
+			controller->m_eeprom.write(ADDR_APIKEY + i, (toHex(key[i * 2]) << 4) | toHex(key[i * 2 + 1]));
 		}
 	}
 }
 
 bool GetRunSchedules()
 {
-	return EEPROM.read(ADDR_OP1) & 0x01;
+	return controller->m_eeprom.read(ADDR_OP1) & 0x01;
 }
 
 void SetRunSchedules(bool value)
 {
-	uint8_t current = EEPROM.read(ADDR_OP1);
+	uint8_t current = controller->m_eeprom.read(ADDR_OP1);
 	if (value)
-		EEPROM.write(ADDR_OP1, current | 0x01);
+		controller->m_eeprom.write(ADDR_OP1, current | 0x01);
 	else
-		EEPROM.write(ADDR_OP1, current & ~0x01);
+		controller->m_eeprom.write(ADDR_OP1, current & ~0x01);
 }
 
 bool GetUsePWS()
 {
-	return EEPROM.read(ADDR_OP1) & 0x02;
+	return controller->m_eeprom.read(ADDR_OP1) & 0x02;
 }
 
 void SetUsePWS(bool value)
 {
-	uint8_t current = EEPROM.read(ADDR_OP1);
+	uint8_t current = controller->m_eeprom.read(ADDR_OP1);
 	if (value)
-		EEPROM.write(ADDR_OP1, current | 0x02);
+		controller->m_eeprom.write(ADDR_OP1, current | 0x02);
 	else
-		EEPROM.write(ADDR_OP1, current & ~0x02);
+		controller->m_eeprom.write(ADDR_OP1, current & ~0x02);
 }
 
 bool GetDHCP()
 {
-	return EEPROM.read(ADDR_DHCP);
+	return controller->m_eeprom.read(ADDR_DHCP);
 }
 
 void SetDHCP(const bool value)
 {
-	EEPROM.write(ADDR_DHCP, value);
+	controller->m_eeprom.write(ADDR_DHCP, value);
 }
 
 EOT GetOT()
 {
-	return (EOT)EEPROM.read(ADDR_OTYPE);
+	return (EOT)controller->m_eeprom.read(ADDR_OTYPE);
 }
 
 void SetOT(EOT oType)
@@ -588,30 +674,132 @@ void SetOT(EOT oType)
 	// if things have changed make sure we re-run the io_setup routine.
 	if (GetOT() != oType)
 	{
-		EEPROM.write(ADDR_OTYPE, oType);
+		controller->m_eeprom.write(ADDR_OTYPE, oType);
 		io_setup();
 	}
 }
 
 uint16_t GetWebPort()
 {
-	return EEPROM.read(ADDR_WEB)<<8 | EEPROM.read(ADDR_WEB+1);
+	return controller->m_eeprom.read(ADDR_WEB)<<8 | controller->m_eeprom.read(ADDR_WEB+1);
 }
 
 void SetWebPort(uint16_t port)
 {
-	EEPROM.write(ADDR_WEB, port>>8);
-	EEPROM.write(ADDR_WEB+1, port&0x00FF);
+	controller->m_eeprom.write(ADDR_WEB, port>>8);
+	controller->m_eeprom.write(ADDR_WEB+1, port&0x00FF);
 }
 
 uint8_t GetSeasonalAdjust()
 {
-	return EEPROM.read(ADDR_SADJ);
+	return controller->m_eeprom.read(ADDR_SADJ);
 }
 
 void SetSeasonalAdjust(uint8_t val)
 {
-	EEPROM.write(ADDR_SADJ, spi_min(val, 200));
+	controller->m_eeprom.write(ADDR_SADJ, spi_min(val, 200));
+}
+
+uint8_t GetFlowCapacity()
+{
+	return controller->m_eeprom.read(ADDR_CAPACITY);
+}
+
+void SetFlowCapacity(uint8_t val)
+{
+	controller->m_eeprom.write(ADDR_CAPACITY, val);
+}
+
+// S1.2 stored the zone durations as whole minutes in a single byte each.  Like every settings file
+//  before S1.4, the schedules are in the original layout.
+static void UpdateS12toS13()
+{
+	trace(F("Updating settings from S1.2 to S1.3\n"));
+	Schedule sched;
+	const int duration_offset = (char*) sched.zone_duration - (char*) &sched;
+	for (int num = 0; num < GetNumSchedules(); num++)
+	{
+		const int addr = LEGACY_SCHEDULE_OFFSET + LEGACY_SCHEDULE_INDEX * num + duration_offset;
+		uint8_t minutes[LEGACY_ZONES];
+		for (uint8_t i = 0; i < sizeof(minutes); i++)
+			minutes[i] = controller->m_eeprom.read(addr + i);
+		for (uint8_t i = 0; i < sizeof(minutes); i++)
+		{
+			const uint16_t seconds = minutes[i] * 60;
+			controller->m_eeprom.write(addr + i * 2, seconds & 0xFF);
+			controller->m_eeprom.write(addr + i * 2 + 1, seconds >> 8);
+		}
+	}
+}
+
+// S1.3 and earlier had 60 byte schedule slots, with no room for a cron expression.  The slots are moved
+//  up from the last one down, so none is overwritten before it has been moved.
+#define S13_SCHEDULE_INDEX 60
+static void UpdateS13toS14()
+{
+	trace(F("Updating settings from S1.3 to S1.4\n"));
+	for (int num = GetNumSchedules() - 1; num >= 0; num--)
+	{
+		for (int i = S13_SCHEDULE_INDEX - 1; i >= 0; i--)
+			controller->m_eeprom.write(LEGACY_SCHEDULE_OFFSET + LEGACY_SCHEDULE_INDEX * num + i,
+					controller->m_eeprom.read(LEGACY_SCHEDULE_OFFSET + S13_SCHEDULE_INDEX * num + i));
+		for (int i = S13_SCHEDULE_INDEX; i < LEGACY_SCHEDULE_INDEX; i++)
+			controller->m_eeprom.write(LEGACY_SCHEDULE_OFFSET + LEGACY_SCHEDULE_INDEX * num + i, 0);
+	}
+}
+
+// The zone and schedule blocks were laid out for a different number of zones (0 for the original
+//  layout).  Everything is copied out first, as the old and new blocks can overlap.
+static void UpdateZoneLayout(int old_layout)
+{
+	trace(F("Moving zones and schedules from a layout for %d zones to %d\n"), old_layout, NUM_ZONES);
+	const int old_zones = (old_layout > LEGACY_ZONES) ? old_layout : LEGACY_ZONES;
+	const int zone_offset = (old_layout > LEGACY_ZONES) ? 2048 : LEGACY_ZONE_OFFSET;
+	const int schedule_offset = (old_layout > LEGACY_ZONES) ? 2048 + ZONE_INDEX * old_zones : LEGACY_SCHEDULE_OFFSET;
+	const int schedule_index = SCHEDULE_SLOT(old_zones);
+	const int iNumSchedules = GetNumSchedules();
+
+	uint8_t * zones = new uint8_t[ZONE_INDEX * old_zones];
+	uint8_t * scheds = new uint8_t[schedule_index * iNumSchedules];
+	for (int i = 0; i < ZONE_INDEX * old_zones; i++)
+		zones[i] = controller->m_eeprom.read(zone_offset + i);
+	for (int i = 0; i < schedule_index * iNumSchedules; i++)
+		scheds[i] = controller->m_eeprom.read(schedule_offset + i);
+
+	FullZone zone = {0};
+	for (int num = 0; num < NUM_ZONES; num++)
+	{
+		if (num < old_zones)
+			memcpy(&zone, zones + ZONE_INDEX * num, sizeof(zone));
+		else
+		{
+			memset(&zone, 0, sizeof(zone));
+			sprintf(zone.name, "Zone %d", num + 1);
+		}
+		SaveZone(num, &zone);
+	}
+
+	// the durations grow or shrink, the cron expression stays at the end of the slot
+	for (int num = 0; num < iNumSchedules; num++)
+	{
+		const uint8_t * slot = scheds + schedule_index * num;
+		Schedule sched;
+		const int duration_offset = (char*) sched.zone_duration - (char*) &sched;
+		memcpy(&sched, slot, duration_offset);
+		for (int i = 0; (i < SCHEDULE_ZONES) && (i < old_zones); i++)
+			sched.zone_duration[i] = slot[duration_offset + i * 2] | (slot[duration_offset + i * 2 + 1] << 8);
+		memcpy(&sched.cron, slot + schedule_index - sizeof(Cron), sizeof(Cron));
+		SaveSchedule(num, &sched);
+	}
+	delete [] zones;
+	delete [] scheds;
+	controller->m_eeprom.write(ADDR_ZONE_LAYOUT, (NUM_ZONES > LEGACY_ZONES) ? NUM_ZONES : 0);
+}
+
+static int ZoneLayout()
+{
+	const int layout = controller->m_eeprom.read(ADDR_ZONE_LAYOUT);
+	return (layout > LEGACY_ZONES) ? layout : 0;
 }
 
 bool IsFirstBoot()
@@ -622,11 +810,323 @@ bool IsFirstBoot()
 		exit(1);
 	}
 
-	if ((EEPROM.read(0) == sHeader[0]) && (EEPROM.read(1) == sHeader[1]) && (EEPROM.read(2) == sHeader[2]) && (EEPROM.read(3) == sHeader[3]))
+	EEPROMClass & eeprom = controller->m_eeprom;
+	const int layout = (NUM_ZONES > LEGACY_ZONES) ? NUM_ZONES : 0;
+	if ((eeprom.read(0) == sHeader[0]) && (eeprom.read(1) == sHeader[1]) && (eeprom.read(2) == sHeader[2]) && (eeprom.read(3) == sHeader[3]))
+	{
+		if (ZoneLayout() != layout)
+			UpdateZoneLayout(ZoneLayout());
 		return false;
+	}
+	if ((eeprom.read(0) == 'S') && (eeprom.read(1) == '1') && (eeprom.read(2) == '.') && ((eeprom.read(3) == '2') || (eeprom.read(3) == '3')))
+	{
+		const bool bS12 = (eeprom.read(3) == '2');
+		UpdateS13toS14();
+		if (bS12)
+			UpdateS12toS13();
+		for (int i = 0; i <= 3; i++)
+			eeprom.write(i, sHeader[i]);
+		// the layout byte was unused before S1.4
+		eeprom.write(ADDR_ZONE_LAYOUT, 0);
+		if (layout != 0)
+			UpdateZoneLayout(0);
+		return false;
+	}
 	return true;
 }
 
+#define SETTINGS_MAGIC "SPRK"
+#define SETTINGS_SCHEMA 1
+#define SETTINGS_HEADER_LEN 6
+
+// Record tags.  A tag is never reused once it's been written out.
+#define TAG_ZONE		0x100	// the zone index, then the ZONE_ fields
+#define TAG_SCHEDULE	0x200	// the schedule index, then the SCHED_ fields as records of their own
+#define SCHED_BASE		1		// flags, day or interval, name and start times
+#define SCHED_DURATIONS	2		// seconds, a uint16_t for each zone
+#define SCHED_CRON		3
+
+// the lengths of the fields in the records
+#define NAME_LEN		20
+#define ZONE_LEN		(1 + 1 + NAME_LEN + 3)
+#define SCHED_BASE_LEN	(1 + 1 + NAME_LEN + 4 * 2)
+#define SCHED_CRON_LEN	(4 * 4 + 2 + 1 + 1)
+static_assert((sizeof(FullZone::name) == NAME_LEN) && (sizeof(Schedule::name) == NAME_LEN), "NAME_LEN is the length of the names");
+
+// Each of the other settings is a record of its own, tagged 1 and up.  They're single bytes in the image
+//  already, so are copied as they are.
+static const struct SettingRecord
+{
+	uint16_t tag;
+	uint16_t addr;
+	uint8_t len;
+} sSettingRecords[] = {
+	{1, ADDR_OP1, 1}, {2, ADDR_NTP_IP, 4}, {3, ADDR_NTP_OFFSET, 1}, {4, ADDR_IP, 4}, {5, ADDR_NETMASK, 4},
+	{6, ADDR_GATEWAY, 4}, {7, ADDR_WUIP, 4}, {8, ADDR_ZIP, 4}, {9, ADDR_APIKEY, 8}, {10, ADDR_OTYPE, 1},
+	{11, ADDR_WEB, 2}, {12, ADDR_SADJ, 1}, {13, ADDR_PWS, LEN_PWS}, {14, ADDR_APIID, LEN_APIID},
+	{15, ADDR_APISECRET, LEN_APISECRET}, {16, ADDR_LOC, LEN_LOC}, {17, ADDR_CAPACITY, 1},
+};
+#define NUM_SETTING_RECORDS (sizeof(sSettingRecords) / sizeof(sSettingRecords[0]))
+
+static uint8_t * Put8(uint8_t * p, uint8_t val)
+{
+	*p = val;
+	return p + 1;
+}
+
+static uint8_t * Put16(uint8_t * p, uint16_t val)
+{
+	p[0] = val & 0xFF;
+	p[1] = val >> 8;
+	return p + 2;
+}
+
+static uint8_t * Put32(uint8_t * p, uint32_t val)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = (val >> (8 * i)) & 0xFF;
+	return p + 4;
+}
+
+static uint8_t * PutBytes(uint8_t * p, const void * data, int len)
+{
+	memcpy(p, data, len);
+	return p + len;
+}
+
+static uint8_t * PutRecord(uint8_t * p, uint16_t tag, const void * data, uint16_t len)
+{
+	p = Put16(p, tag);
+	p = Put16(p, len);
+	return PutBytes(p, data, len);
+}
+
+// Reads the fields of a record back.  Past the end of the record they read as 0.
+class FieldReader
+{
+public:
+	FieldReader(const uint8_t * data, int len) : m_p(data), m_end(data + len) {}
+	uint8_t Get8()
+	{
+		return (m_p < m_end) ? *m_p++ : 0;
+	}
+	uint16_t Get16()
+	{
+		const uint16_t lo = Get8();
+		return lo | (uint16_t) Get8() << 8;
+	}
+	uint32_t Get32()
+	{
+		const uint32_t lo = Get16();
+		return lo | (uint32_t) Get16() << 16;
+	}
+	void GetBytes(void * data, int len)
+	{
+		for (int i = 0; i < len; i++)
+			((uint8_t *) data)[i] = Get8();
+	}
+private:
+	const uint8_t * m_p;
+	const uint8_t * m_end;
+};
+
+// The data of the record at p, or NULL if there isn't a whole one before end
+static const uint8_t * GetRecord(const uint8_t * p, const uint8_t * end, uint16_t * pTag, uint16_t * pLen)
+{
+	if (end - p < 4)
+		return NULL;
+	FieldReader header(p, 4);
+	*pTag = header.Get16();
+	*pLen = header.Get16();
+	if (end - p - 4 < *pLen)
+		return NULL;
+	return p + 4;
+}
+
+bool IsSettingsFile(const uint8_t * file, long len)
+{
+	return (len >= SETTINGS_HEADER_LEN) && (memcmp(file, SETTINGS_MAGIC, 4) == 0);
+}
+
+static void DecodeZone(const uint8_t * data, uint16_t len, FullZone * pZone)
+{
+	memset(pZone, 0, sizeof(FullZone));
+	FieldReader r(data, len);
+	const uint8_t flags = r.Get8();
+	pZone->bEnabled = flags & 0x01;
+	pZone->bPump = (flags & 0x02) != 0;
+	r.GetBytes(pZone->name, NAME_LEN);
+	pZone->name[NAME_LEN - 1] = 0;
+	pZone->flow = r.Get8();
+	pZone->cycle = r.Get8();
+	pZone->soak = r.Get8();
+}
+
+static void DecodeSchedule(const uint8_t * data, uint16_t len, Schedule * pSched)
+{
+	const uint8_t * end = data + len;
+	memset((void *) pSched, 0, sizeof(Schedule));
+	uint16_t tag, field_len;
+	for (const uint8_t * field; (field = GetRecord(data, end, &tag, &field_len)); data = field + field_len)
+	{
+		FieldReader r(field, field_len);
+		if (tag == SCHED_BASE)
+		{
+			pSched->SetType(r.Get8());
+			pSched->day = r.Get8();
+			r.GetBytes(pSched->name, NAME_LEN);
+			pSched->name[NAME_LEN - 1] = 0;
+			for (int i = 0; i < 4; i++)
+				pSched->time[i] = (int16_t) r.Get16();
+		}
+		else if (tag == SCHED_DURATIONS)
+		{
+			for (int i = 0; i < SCHEDULE_ZONES; i++)
+				pSched->zone_duration[i] = r.Get16();
+		}
+		else if (tag == SCHED_CRON)
+		{
+			pSched->cron.minute[0] = r.Get32();
+			pSched->cron.minute[1] = r.Get32();
+			pSched->cron.hour = r.Get32();
+			pSched->cron.mday = r.Get32();
+			pSched->cron.month = r.Get16();
+			pSched->cron.wday = r.Get8();
+			pSched->cron.flags = r.Get8();
+		}
+	}
+}
+
+int DecodeSettings(const uint8_t * file, long len, uint8_t ** pImage)
+{
+	const uint8_t * end = file + len;
+	FieldReader header(file + 4, 2);
+	const int schema = header.Get16();
+	if (schema > SETTINGS_SCHEMA)
+		trace(F("Settings file is schema %d, newer than %d.  What it added is skipped.\n"), schema, SETTINGS_SCHEMA);
+
+	// size the image for the schedules there are
+	int iNumSchedules = 0;
+	uint16_t tag, rec_len;
+	const uint8_t * data;
+	for (const uint8_t * p = file + SETTINGS_HEADER_LEN; (data = GetRecord(p, end, &tag, &rec_len)); p = data + rec_len)
+		if ((tag == TAG_SCHEDULE) && (rec_len > 0) && (data[0] < MAX_SCHEDULES))
+			iNumSchedules = spi_max(iNumSchedules, data[0] + 1);
+	const int size = spi_max(EEPROM_SIZE, SCHEDULE_OFFSET + SCHEDULE_INDEX * iNumSchedules);
+	uint8_t * image = new uint8_t[size];
+	memset(image, 0, size);
+	memcpy(image, sHeader, 4);
+	image[ADDR_SCHEDULE_COUNT] = iNumSchedules;
+	image[ADDR_ZONE_LAYOUT] = (NUM_ZONES > LEGACY_ZONES) ? NUM_ZONES : 0;
+
+	bool bZone[NUM_ZONES] = {false};
+	for (const uint8_t * p = file + SETTINGS_HEADER_LEN; (data = GetRecord(p, end, &tag, &rec_len)); p = data + rec_len)
+	{
+		if ((tag == TAG_ZONE) && (rec_len > 0) && (data[0] < NUM_ZONES))
+		{
+			FullZone zone;
+			DecodeZone(data + 1, rec_len - 1, &zone);
+			memcpy(image + ZONE_OFFSET + ZONE_INDEX * data[0], &zone, sizeof(zone));
+			bZone[data[0]] = true;
+		}
+		else if ((tag == TAG_SCHEDULE) && (rec_len > 0) && (data[0] < MAX_SCHEDULES))
+		{
+			Schedule sched;
+			DecodeSchedule(data + 1, rec_len - 1, &sched);
+			memcpy(image + SCHEDULE_OFFSET + SCHEDULE_INDEX * data[0], &sched, sizeof(Schedule));
+		}
+		else
+		{
+			for (unsigned i = 0; i < NUM_SETTING_RECORDS; i++)
+				if (sSettingRecords[i].tag == tag)
+					memcpy(image + sSettingRecords[i].addr, data, spi_min(rec_len, sSettingRecords[i].len));
+		}
+	}
+	// zones past the ones a build with fewer zones wrote out
+	for (int num = 0; num < NUM_ZONES; num++)
+	{
+		if (bZone[num])
+			continue;
+		FullZone zone = {0};
+		sprintf(zone.name, "Zone %d", num + 1);
+		memcpy(image + ZONE_OFFSET + ZONE_INDEX * num, &zone, sizeof(zone));
+	}
+	*pImage = image;
+	return size;
+}
+
+long EncodeSettings(const uint8_t * image, int size, uint8_t ** pFile)
+{
+	const int iNumSchedules = spi_min(image[ADDR_SCHEDULE_COUNT], MAX_SCHEDULES);
+	long max_len = SETTINGS_HEADER_LEN + NUM_ZONES * (4 + 1 + ZONE_LEN)
+			+ iNumSchedules * (4 + 1 + 3 * 4 + SCHED_BASE_LEN + 2 * SCHEDULE_ZONES + SCHED_CRON_LEN);
+	for (unsigned i = 0; i < NUM_SETTING_RECORDS; i++)
+		max_len += 4 + sSettingRecords[i].len;
+	uint8_t * file = new uint8_t[max_len];
+	uint8_t * p = file;
+	p = PutBytes(p, SETTINGS_MAGIC, 4);
+	p = Put16(p, SETTINGS_SCHEMA);
+
+	for (unsigned i = 0; i < NUM_SETTING_RECORDS; i++)
+		p = PutRecord(p, sSettingRecords[i].tag, image + sSettingRecords[i].addr, sSettingRecords[i].len);
+
+	for (int num = 0; num < NUM_ZONES; num++)
+	{
+		FullZone zone;
+		memcpy(&zone, image + ZONE_OFFSET + ZONE_INDEX * num, sizeof(FullZone));
+		uint8_t rec[1 + ZONE_LEN];
+		uint8_t * field = rec;
+		field = Put8(field, num);
+		field = Put8(field, (zone.bEnabled ? 0x01 : 0) | (zone.bPump ? 0x02 : 0));
+		field = PutBytes(field, zone.name, NAME_LEN);
+		field = Put8(field, zone.flow);
+		field = Put8(field, zone.cycle);
+		field = Put8(field, zone.soak);
+		p = PutRecord(p, TAG_ZONE, rec, field - rec);
+	}
+
+	for (int num = 0; num < iNumSchedules; num++)
+	{
+		// the last slot can be short of a whole Schedule
+		Schedule sched;
+		const int addr = SCHEDULE_OFFSET + SCHEDULE_INDEX * num;
+		memcpy(&sched, image + addr, spi_max(0, spi_min((int) sizeof(sched), size - addr)));
+		uint8_t rec[1 + 3 * 4 + SCHED_BASE_LEN + 2 * SCHEDULE_ZONES + SCHED_CRON_LEN];
+		uint8_t * field = rec;
+		field = Put8(field, num);
+
+		uint8_t base[SCHED_BASE_LEN];
+		uint8_t * b = base;
+		b = Put8(b, sched.GetType());
+		b = Put8(b, sched.day);
+		b = PutBytes(b, sched.name, NAME_LEN);
+		for (int i = 0; i < 4; i++)
+			b = Put16(b, sched.time[i]);
+		field = PutRecord(field, SCHED_BASE, base, b - base);
+
+		uint8_t durations[2 * SCHEDULE_ZONES];
+		b = durations;
+		for (int i = 0; i < SCHEDULE_ZONES; i++)
+			b = Put16(b, sched.zone_duration[i]);
+		field = PutRecord(field, SCHED_DURATIONS, durations, b - durations);
+
+		uint8_t cron[SCHED_CRON_LEN];
+		b = cron;
+		b = Put32(b, sched.cron.minute[0]);
+		b = Put32(b, sched.cron.minute[1]);
+		b = Put32(b, sched.cron.hour);
+		b = Put32(b, sched.cron.mday);
+		b = Put16(b, sched.cron.month);
+		b = Put8(b, sched.cron.wday);
+		b = Put8(b, sched.cron.flags);
+		field = PutRecord(field, SCHED_CRON, cron, b - cron);
+
+		p = PutRecord(p, TAG_SCHEDULE, rec, field - rec);
+	}
+	*pFile = file;
+	return p - file;
+}
+
 int GetNumEnabledZones()
 {
 	ShortZone sz;
@@ -640,5 +1140,3 @@ int GetNumEnabledZones()
 	return retval;
 }
 
-Schedule quickSchedule;
-
@@ -37,18 +37,44 @@
 #define LEN_APISECRET			64
 #define ADDR_LOC				1119
 #define LEN_LOC					50
-#define ADDR_					1169
+#define ADDR_CAPACITY			1169
+#define ADDR_ZONE_LAYOUT		1170 // zones the zone and schedule blocks are laid out for, 0 for up to 15
+#define ADDR_					1171
 
-#define SCHEDULE_OFFSET 1200
-#define SCHEDULE_INDEX 60
-#define ZONE_OFFSET 20
+// Up to LEGACY_ZONES zones, the zone block fits in the original 2048 bytes.  With more it goes after
+//  them, sized for NUM_ZONES.  The schedule block is always last, so it can run on past the end of the
+//  settings file, which grows to fit however many schedules there are.
+#define LEGACY_ZONES 15
+#define MAX_ZONES 128
 #define ZONE_INDEX 25
+// a Schedule with durations for this many zones, followed by its 20 byte Cron
+#define SCHEDULE_SLOT(zones) ((30 + 2 * (zones) + 3) / 4 * 4 + 20)
+#define LEGACY_ZONE_OFFSET 20
+#define LEGACY_SCHEDULE_OFFSET 1200
+#define LEGACY_SCHEDULE_INDEX SCHEDULE_SLOT(LEGACY_ZONES)
+
+#if NUM_ZONES > MAX_ZONES
+#error Number of Zones is too large
+#elif NUM_ZONES > LEGACY_ZONES
+#define SCHEDULE_ZONES NUM_ZONES
+#define ZONE_OFFSET 2048
+#define SCHEDULE_OFFSET (ZONE_OFFSET + ZONE_INDEX * NUM_ZONES)
+#define SCHEDULE_INDEX SCHEDULE_SLOT(NUM_ZONES)
+#define EEPROM_SIZE SCHEDULE_OFFSET
+#else
+#define SCHEDULE_ZONES LEGACY_ZONES
+#define ZONE_OFFSET LEGACY_ZONE_OFFSET
+#define SCHEDULE_OFFSET LEGACY_SCHEDULE_OFFSET
+#define SCHEDULE_INDEX LEGACY_SCHEDULE_INDEX
+#define EEPROM_SIZE END_OF_SCHEDULE_BLOCK
 
 #if ZONE_OFFSET + (ZONE_INDEX * NUM_ZONES) > END_OF_ZONE_BLOCK
 #error Number of Zones is too large
 #endif
+#endif
 
-#if SCHEDULE_OFFSET + (SCHEDULE_INDEX * MAX_SCHEDULES) > END_OF_SCHEDULE_BLOCK
+// schedule numbers are kept in a byte, with QUICK_SCHEDULE (see core.h) left over for the quick schedule
+#if MAX_SCHEDULES > 254
 #error Number of Schedules is too large
 #endif
 
@@ -58,6 +84,21 @@
 #include "core.h"
 #include "web.h"
 #include "port.h"
+#include "Calendar.h"
+#include "Cron.h"
+
+// Schedule start times are minutes past midnight, or with one of these flags set, minutes before (-)
+//  or after (+) sunrise or sunset, stored with TIME_OFFSET_BIAS added.
+#define TIME_SUNRISE		0x2000
+#define TIME_SUNSET			0x4000
+#define TIME_OFFSET_BIAS	0x1000
+#define TIME_OFFSET_MASK	0x1FFF
+#define MAX_SOLAR_OFFSET	720
+
+static inline int TimeOffset(short time)
+{
+	return (time & TIME_OFFSET_MASK) - TIME_OFFSET_BIAS;
+}
 
 class Schedule
 {
@@ -71,12 +112,14 @@ public:
 	};
 	char name[20];
 	short time[4];
-	uint8_t zone_duration[15];
+	uint16_t zone_duration[SCHEDULE_ZONES];	// seconds
+	Cron cron;	// start times and days of a cron schedule, which ignores day, interval and time
 	Schedule();
 	bool IsEnabled() const { return m_type & 0x01; }
 	bool IsInterval() const { return m_type & 0x02; }
 	bool IsWAdj() const { return m_type & 0x04; }
 	bool IsRestricted() const { return m_type & 0x08; }
+	bool IsCron() const { return m_type & 0x20; }
 	uint8_t GetRestriction() const {
 		if (IsRestricted()) {
 			if (m_type & 0x10) {
@@ -87,46 +130,68 @@ public:
 		}
 		return 0;
 	}
-	bool IsRunToday(time_t time_now) {
-		uint8_t restrictions = GetRestriction();
-		if ((IsEnabled())	// do nothing if not enabled
-			&& (((IsInterval()) && ((elapsedDays(time_now) % interval) == 0))	// if interval is enabled, check days since last run
-				|| (!(IsInterval())
-					&& ((restrictions == 0) || ((mday(time_now)%2) == (restrictions%2)))	// if even/odd restrictions are enabled check day of month number
-					&& (day & (0x01 << (weekday(time_now) - 1))))))	// if day of week schedule check day of week
-			return true;
-		return false;
-	}
-	bool IsRunTomorrow(time_t time_now) {
-		return IsRunToday(time_now+SECS_PER_DAY);
-	}
-	int NextRun(time_t time_now, char* str) {
+	// days is this schedule's calendar (see Calendar.h), starting today
+	int NextRun(CalendarDays days, const TimeContext & now, char* str) {
 		char scheduledTimes[100];
 
+		if (IsCron()) {
+			return NextCronRun(days, now, str);
+		}
 		if (GetEnabledTimes(scheduledTimes) == -1) {
 			return sprintf(str, "n/a");
 		}
-		if (!IsRunToday(time_now) && !IsRunTomorrow(time_now)) {
-			int days = 2;
-			while (days <= 14 && !IsRunToday(time_now + (SECS_PER_DAY*days))) {
-				days++;
-			}
-			if (days > 14) {
-				return sprintf(str, "In 14+ days @ %s", scheduledTimes);
-			}
-			return sprintf(str, "In %d days @ %s", days, scheduledTimes);
+		const int next = Calendar::DaysUntilRun(days);
+		if ((next < 0) || (next > 14)) {
+			return sprintf(str, "In 14+ days @ %s", scheduledTimes);
+		}
+		if (next >= 2) {
+			return sprintf(str, "In %d days @ %s", next, scheduledTimes);
 		}
 
 		return sprintf(str, "%s @ %s",
-					   IsRunToday(time_now) ? "Today" : "Tomorrow",
+					   (next == 0) ? "Today" : "Tomorrow",
 					   scheduledTimes);
 	}
+	// A cron schedule's next start, which today may already have gone by
+	int NextCronRun(CalendarDays days, const TimeContext & now, char* str) {
+		short minute = -1;
+		if (days & 0x01) {
+			minute = cron.NextMinute(now.minutes);
+		}
+		if (minute == -1) {
+			days &= ~(CalendarDays) 0x01;
+			minute = cron.NextMinute(-1);
+		}
+		const int next = Calendar::DaysUntilRun(days);
+		if (!IsEnabled() || (minute == -1) || (next < 0)) {
+			return sprintf(str, "n/a");
+		}
+		char scheduledTime[16];
+		FormatMinute(minute, scheduledTime);
+		if (next > 14) {
+			return sprintf(str, "In 14+ days @ %s", scheduledTime);
+		}
+		if (next >= 2) {
+			return sprintf(str, "In %d days @ %s", next, scheduledTime);
+		}
+		return sprintf(str, "%s @ %s", (next == 0) ? "Today" : "Tomorrow", scheduledTime);
+	}
+	static int FormatMinute(short x, char* str) {
+		const int h = x/60;
+#ifdef CLOCK_24H
+		return sprintf(str, "%d:%.2d", h, x%60);
+#else
+		return sprintf(str, "%d:%.2d %s",
+				(h%12 == 0 ? 12 : h%12),
+				x%60,
+				(h < 12 ? "AM" : "PM"));
+#endif
+	}
 	int GetEnabledTimes(char* str) {
 		if (!IsEnabled()) {
 			return -1;
 		}
-		char buff[10];
-		int h;
+		char buff[16];
 		short x;
 		bool enabled = false;
 		str[0] = '\0';
@@ -139,15 +204,16 @@ public:
 				} else {
 					enabled = true;
 				}
-				h = x/60;
-#ifdef CLOCK_24H
-				sprintf(buff, "%d:%.2d", h, x%60);
-#else
-				sprintf(buff, "%d:%.2d %s",
-						(h%12 == 0 ? 12 : h%12),
-						x%60,
-						(h < 12 ? "AM" : "PM"));
-#endif
+				if (x & (TIME_SUNRISE | TIME_SUNSET)) {
+					const int offset = TimeOffset(x);
+					if (offset == 0)
+						sprintf(buff, "%s", (x & TIME_SUNRISE) ? "Sunrise" : "Sunset");
+					else
+						sprintf(buff, "%s%+d", (x & TIME_SUNRISE) ? "Sunrise" : "Sunset", offset);
+					strcat(str, buff);
+					continue;
+				}
+				FormatMinute(x, buff);
 				strcat(str, buff);
 			}
 		}
@@ -159,6 +225,7 @@ public:
 	void SetEnabled(bool val) { m_type = val ? (m_type | 0x01) : (m_type & ~0x01); }
 	void SetInterval(bool val) { m_type = val ? (m_type | 0x02) : (m_type & ~0x02); }
 	void SetWAdj(bool val) { m_type = val ? (m_type | 0x04) : (m_type & ~0x04); }
+	void SetCron(bool val) { m_type = val ? (m_type | 0x20) : (m_type & ~0x20); }
 	void SetRestriction(uint8_t val) {
 		if (val == 1) {
 			m_type = (m_type | 0x08) & ~0x10;
@@ -168,6 +235,9 @@ public:
 			m_type = (m_type & ~0x18);
 		}
 	}
+	// all the flags at once, for the settings file
+	uint8_t GetType() const { return m_type; }
+	void SetType(uint8_t type) { m_type = type; }
 };
 
 struct FullZone
@@ -175,6 +245,9 @@ struct FullZone
 	bool bEnabled :1;
 	bool bPump :1;
 	char name[20];
+	uint8_t flow;	// flow/current cost of this zone, 0 means it must run alone
+	uint8_t cycle;	// longest single cycle in minutes, 0 runs the whole duration at once
+	uint8_t soak;	// minimum minutes between cycles
 };
 
 struct ShortZone
@@ -211,7 +284,7 @@ bool GetRunSchedules();
 void SetRunSchedules(bool value);
 bool GetDHCP();
 void SetDHCP(const bool value);
-enum EOT {OT_NONE, OT_DIRECT_POS, OT_DIRECT_NEG, OT_OPEN_SPRINKLER};
+enum EOT {OT_NONE, OT_DIRECT_POS, OT_DIRECT_NEG, OT_OPEN_SPRINKLER, OT_COPROCESS, OT_SIMULATED};
 EOT GetOT();
 void SetOT(EOT oType);
 uint16_t GetWebPort();
@@ -222,6 +295,8 @@ void GetPWS(char * key);
 void SetPWS(const char * key);
 void GetLoc(char * key);
 void SetLoc(const char * key);
+uint8_t GetFlowCapacity();
+void SetFlowCapacity(uint8_t);
 bool GetUsePWS();
 void SetUsePWS(bool value);
 void LoadSchedule(uint8_t num, Schedule * pSched);
@@ -229,18 +304,28 @@ void LoadZone(uint8_t num, FullZone * pZone);
 void LoadShortZone(uint8_t index, ShortZone * pZone);
 
 // KV Pairs Setters
-bool SetSchedule(const KVPairs & key_value_pairs);
+bool SetSchedule(const KVPairs & key_value_pairs, int * pSchedNum = 0);
 bool SetZones(const KVPairs & key_value_pairs);
-bool DeleteSchedule(const KVPairs & key_value_pairs);
+bool DeleteSchedule(const KVPairs & key_value_pairs, int * pSchedNum = 0);
 bool SetSettings(const KVPairs & key_value_pairs);
+uint16_t ParseDuration(const char * value);
+// Zone keys are z and the zone number, e.g. z1 or z12name.  zb to zp, from when there could only be 15
+//  zones, still work.  Returns the zone index from 0, or -1, and points pRest past the zone.
+int ParseZoneKey(const char * key, const char ** pRest = 0);
 
 // Misc
 bool IsFirstBoot();
 void ResetEEPROM();
-int GetNumEnabledZones();
 
-// For storing info related to the Quick Schedule
-extern Schedule quickSchedule;
+// The settings file: a magic, a schema version, then tagged, length prefixed records.  A record this
+//  build doesn't know is skipped, and one shorter than it expects reads the rest as 0.  Every field is
+//  written at a fixed width, least significant byte first, so the file doesn't depend on the host.
+bool IsSettingsFile(const uint8_t * file, long len);
+// Build the EEPROM image for this build from the records, returning its size
+int DecodeSettings(const uint8_t * file, long len, uint8_t ** pImage);
+// Write the EEPROM image out as records, returning the length of the file
+long EncodeSettings(const uint8_t * image, int size, uint8_t ** pFile);
+int GetNumEnabledZones();
 
 #endif
 
@@ -6,6 +6,8 @@
 
 #include "core.h"
 #include "settings.h"
+#include "Controller.h"
+#include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 
@@ -30,10 +32,14 @@ int main(int argc, char **argv)
 	signal(SIGPIPE, signal_pipe_callback_handler);
 
 	char * logfile = 0;
+	int iControllers = 1;
 	int c = -1;
-	while ((c = getopt(argc, argv, "?L:Vv")) != -1)
+	while ((c = getopt(argc, argv, "?C:L:Vv")) != -1)
 		switch (c)
 		{
+		case 'C':
+			iControllers = atoi(optarg);
+			break;
 		case 'L':
 			logfile = optarg;
 			break;
@@ -43,10 +49,10 @@ int main(int argc, char **argv)
 			return 0;
 			break;
         case '?':
-          if (optopt == 'L')
+          if ((optopt == 'L') || (optopt == 'C'))
             fprintf (stderr, "Option -%c requires an argument.\n", optopt);
           else
-            fprintf (stderr, "Usage: %s [ -L(LOGFILE) ]'.\n", argv[0]);
+            fprintf (stderr, "Usage: %s [ -L(LOGFILE) ] [ -C(CONTROLLERS) ]'.\n", argv[0]);
           return 1;
         default:
           return 1;
@@ -61,11 +67,22 @@ int main(int argc, char **argv)
 		}
 	}
 	trace("Starting v%s..\n", VERSION);
+	// the first controller is in the working directory, the rest in c1/, c2/ and so on
+	for (int i = 1; i < iControllers; i++)
+		if (!AddController())
+		{
+			trace("Only %d controllers are allowed\n", MAX_CONTROLLERS);
+			return 1;
+		}
 	while (!bTermSignal)
 	{
 		mainLoop();
-		usleep(1000);  // sleep for 1 ms
+		// wait 1 ms, or less if an input changes
+		WaitForInputs(1);
 	}
+	// the last few settings changes may still be waiting to be written
+	for (int i = 0; i < iNumControllers; i++)
+		controllers[i]->m_eeprom.Flush();
 	trace("Exiting.\n");
 	return 0;
 }
@@ -0,0 +1,197 @@
+// sprinklers_sim.cpp
+// Schedule simulator.  Runs the real scheduler against a virtual clock and prints
+//  a timeline of every output change, so weeks of schedules can be checked in seconds.
+//  Uses the settings file in the current directory, the same as the daemon, but never writes it or
+//  the journal, so it can be run alongside the daemon.
+//
+
+#include "core.h"
+#include "settings.h"
+#include "Controller.h"
+#include "Event.h"
+#include "FlowMeter.h"
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+class SimClock : public Clock
+{
+public:
+	SimClock(time_t start) : m_now(start) {}
+	time_t utcNow()
+	{
+		return m_now;
+	}
+	void Set(time_t t)
+	{
+		m_now = t;
+	}
+private:
+	time_t m_now;
+};
+
+static SimClock * simClock = 0;
+static FILE * timeline = 0;
+static time_t zoneOnTime[NUM_ZONES + 1];
+static unsigned long zoneSeconds[NUM_ZONES + 1];
+static unsigned long zoneStarts[NUM_ZONES + 1];
+static double zoneLitres[NUM_ZONES + 1];
+// zones on in the first controller, each of which the mock meter runs water through
+static int zonesOn = 0;
+
+// Report a change of the outputs to the timeline, and add it to the totals
+static void Latched(time_t t, const ZoneSet & prevState, const ZoneSet & newState)
+{
+	struct tm ti;
+	localtime_r(&t, &ti);
+	const ZoneSet changed = prevState ^ newState;
+	for (int i = changed.Next(-1); (i != -1) && (i <= NUM_ZONES); i = changed.Next(i))
+	{
+		const bool bOn = newState.Test(i);
+		if (i == 0)
+			fprintf(timeline, "%.4d/%.2d/%.2d %.2d:%.2d:%.2d\t%ld\tpump\t%s\n", 1900 + ti.tm_year, ti.tm_mon + 1, ti.tm_mday,
+					ti.tm_hour, ti.tm_min, ti.tm_sec, (long) t, bOn ? "on" : "off");
+		else
+			fprintf(timeline, "%.4d/%.2d/%.2d %.2d:%.2d:%.2d\t%ld\tzone %d\t%s\n", 1900 + ti.tm_year, ti.tm_mon + 1, ti.tm_mday,
+					ti.tm_hour, ti.tm_min, ti.tm_sec, (long) t, i, bOn ? "on" : "off");
+		if (i != 0)
+			zonesOn += bOn ? 1 : -1;
+		if (bOn)
+		{
+			zoneOnTime[i] = t;
+			zoneStarts[i]++;
+		}
+		else if (zoneOnTime[i])
+		{
+			zoneSeconds[i] += t - zoneOnTime[i];
+			zoneOnTime[i] = 0;
+		}
+	}
+}
+
+// Report the changes the first controller's outputs have been latched with since the last time
+static void ReportLatches()
+{
+	static uint32_t reported = 0;
+	static ZoneSet prevState;
+	const SimulatedOutput * sim = static_cast<SimulatedOutput *>(controllers[0]->m_output);
+	for (; reported < sim->Latches(); reported++)
+	{
+		const SimulatedOutput::Transition * t = sim->GetTransition(reported);
+		if (!t)
+			continue;
+		Latched(t->time, prevState, t->state);
+		prevState = t->state;
+	}
+}
+
+void SimZoneLogged(int16_t zone, long, float volume)
+{
+	if (volume > 0)
+		zoneLitres[zone] += volume;
+}
+
+// Stand in for a flow meter, with each zone that's on letting through rate pulses a minute
+static void FeedFlowMeter(long rate, time_t seconds)
+{
+	static double owed = 0;
+	owed += (double) rate * zonesOn * seconds / 60;
+	const uint32_t pulses = (uint32_t) owed;
+	flowMeter.Feed(pulses);
+	owed -= pulses;
+}
+
+// Work out the next time anything can happen: the next pending event, or the top of the
+//  next hour so the midnight reload gets its chance to run.
+static time_t NextWakeup(time_t utc_now)
+{
+	const time_t local_now = nntpTimeServer.LocalNow();
+	const long time_of_day = local_now - previousMidnight(local_now);
+	long wait = SECS_PER_HOUR - (local_now % SECS_PER_HOUR);
+	for (int i = 0; i < controller->m_iNumEvents; i++)
+	{
+		if (controller->m_events[i].time == -1)
+			continue;
+		wait = spi_min(wait, spi_max(controller->m_events[i].time - time_of_day, 1L));
+	}
+	return utc_now + wait;
+}
+
+static time_t ParseStart(const char * value)
+{
+	int y, m, d;
+	if (sscanf(value, "%d-%d-%d", &y, &m, &d) == 3)
+	{
+		struct tm ti = {0};
+		ti.tm_year = y - 1900;
+		ti.tm_mon = m - 1;
+		ti.tm_mday = d;
+		ti.tm_isdst = -1;
+		return mktime(&ti);
+	}
+	return strtol(value, 0, 10);
+}
+
+int main(int argc, char **argv)
+{
+	time_t start = time(0);
+	long days = 7;
+	bool bVerbose = false;
+	long flowRate = 0;
+	int c = -1;
+	while ((c = getopt(argc, argv, "?s:d:f:v")) != -1)
+		switch (c)
+		{
+		case 's':
+			start = ParseStart(optarg);
+			break;
+		case 'd':
+			days = strtol(optarg, 0, 10);
+			break;
+		case 'f':
+			flowRate = strtol(optarg, 0, 10);
+			break;
+		case 'v':
+			bVerbose = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [ -s(START yyyy-mm-dd or epoch) ] [ -d(DAYS) ] [ -f(FLOW METER PULSES A MINUTE PER ZONE) ] [ -v ]\n", argv[0]);
+			return 1;
+		}
+
+	// The timeline goes to stdout, the normal trace output only with -v
+	timeline = fdopen(dup(fileno(stdout)), "w");
+	if (!bVerbose && (freopen("/dev/null", "w", stdout) == 0))
+		return 1;
+
+	SimClock clock(start);
+	simClock = &clock;
+	sysClock = simClock;
+
+	const time_t end = start + days * SECS_PER_DAY;
+	unsigned long ticks = 0;
+	struct timeval wall_start, wall_end;
+	gettimeofday(&wall_start, 0);
+	while (clock.utcNow() < end)
+	{
+		mainLoop();
+		ReportLatches();
+		ticks++;
+		const time_t now = clock.utcNow();
+		clock.Set(NextWakeup(now));
+		if (flowRate)
+			FeedFlowMeter(flowRate, clock.utcNow() - now);
+	}
+	gettimeofday(&wall_end, 0);
+
+	const double wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_usec - wall_start.tv_usec) / 1000000.0;
+	fprintf(timeline, "# simulated %ld days in %lu ticks, %.3f seconds\n", days, ticks, wall);
+	for (int i = 1; i <= NUM_ZONES; i++)
+		if (zoneStarts[i] && flowRate)
+			fprintf(timeline, "# zone %d: %lu runs, %lu minutes, %.1f litres\n", i, zoneStarts[i], zoneSeconds[i] / 60, zoneLitres[i]);
+		else if (zoneStarts[i])
+			fprintf(timeline, "# zone %d: %lu runs, %lu minutes\n", i, zoneStarts[i], zoneSeconds[i] / 60);
+	fclose(timeline);
+	return 0;
+}
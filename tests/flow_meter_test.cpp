@@ -0,0 +1,121 @@
+// flow_meter_test.cpp
+// Feeds pulses to the flow meter while zones run, alone and together, and checks the litres and flow
+//  logged for each run.
+//
+
+#include "core.h"
+#include "Controller.h"
+#include "FlowMeter.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sqlite3.h>
+
+struct LoggedRun
+{
+	int zone;
+	int duration;
+	double volume;
+	double flow;
+};
+
+static int failures = 0;
+
+static void CheckRun(const LoggedRun & run, int zone, int duration, double volume, double flow)
+{
+	// the log keeps 2 decimal places
+	if ((run.zone == zone) && (run.duration == duration) && (fabs(run.volume - volume) < 0.01) && (fabs(run.flow - flow) < 0.01))
+		return;
+	printf("FAIL: logged zone %d, %d s, %.2f L, %.2f L/min; expected zone %d, %d s, %.2f L, %.2f L/min\n", run.zone, run.duration,
+			run.volume, run.flow, zone, duration, volume, flow);
+	failures++;
+}
+
+static int ReadRuns(const char * path, LoggedRun * runs, int max_runs)
+{
+	sqlite3 * db;
+	if (sqlite3_open(path, &db) != SQLITE_OK)
+		return -1;
+	sqlite3_stmt * stmt;
+	int count = 0;
+	if (sqlite3_prepare_v2(db, "SELECT zone, duration, volume, flow FROM zonelog ORDER BY rowid", -1, &stmt, 0) == SQLITE_OK)
+	{
+		while ((count < max_runs) && (sqlite3_step(stmt) == SQLITE_ROW))
+		{
+			runs[count].zone = sqlite3_column_int(stmt, 0);
+			runs[count].duration = sqlite3_column_int(stmt, 1);
+			runs[count].volume = sqlite3_column_double(stmt, 2);
+			runs[count].flow = sqlite3_column_double(stmt, 3);
+			count++;
+		}
+		sqlite3_finalize(stmt);
+	}
+	sqlite3_close(db);
+	return count;
+}
+
+int main()
+{
+	// the database goes in the working directory, as it does for the daemon
+	char dir[] = "/tmp/flowtestXXXXXX";
+	if (!mkdtemp(dir) || (chdir(dir) != 0))
+		return 1;
+	const char * db = "db.sql";
+	if (!controller->m_logger.Init(""))
+		return 1;
+
+	runStateClass & runState = controller->m_runState;
+	const time_t start = 1790000000;
+
+	// before there's any meter, nothing's known about the water
+	tickTime.local = start;
+	runState.SetManual(true, 3);
+	tickTime.local = start + 60;
+	runState.SetManual(false);
+
+	// two zones on together each get half the water
+	tickTime.local = start + 100;
+	runState.SetSchedule(true, QUICK_SCHEDULE);
+	runState.StartZone(1, 0);
+	runState.StartZone(2, 0);
+	flowMeter.Feed(6 * FLOW_PULSES_PER_LITRE);
+	ShareFlow();
+	tickTime.local = start + 160;
+	runState.EndZone(2);
+	// then the one left on gets it all
+	flowMeter.Feed(4 * FLOW_PULSES_PER_LITRE);
+	ShareFlow();
+	tickTime.local = start + 220;
+	runState.SetSchedule(false);
+	// and with nothing on it's no zone's
+	flowMeter.Feed(FLOW_PULSES_PER_LITRE);
+	ShareFlow();
+	tickTime.local = start + 300;
+	runState.SetManual(true, 4);
+	tickTime.local = start + 330;
+	runState.SetManual(false);
+
+	controller->m_logger.Close();
+	LoggedRun runs[8];
+	const int count = ReadRuns(db, runs, 8);
+	if (count != 4)
+	{
+		printf("FAIL: %d runs logged, expected 4\n", count);
+		failures++;
+	}
+	else
+	{
+		CheckRun(runs[0], 3, 60, -1, -1);
+		CheckRun(runs[1], 2, 60, 3, 3);
+		CheckRun(runs[2], 1, 120, 7, 3.5);
+		CheckRun(runs[3], 4, 30, 0, 0);
+	}
+
+	unlink(db);
+	if (chdir("/") == 0)
+		rmdir(dir);
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
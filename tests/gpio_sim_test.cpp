@@ -0,0 +1,200 @@
+// gpio_sim_test.cpp
+// Drives the Direct Positive and Direct Negative outputs on a chip made with the kernel's gpio-sim module,
+//  and checks each line of the board is an output, active low only for negative, and is at the level
+//  the outputs were latched with.  Needs root and gpio-sim in configfs; without them it's skipped.
+//
+
+#include "Output.h"
+#include "Boards.h"
+#include "Gpio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/gpio.h>
+
+// ctest's SKIP_RETURN_CODE
+#define SKIP 77
+#define CONFIGFS "/sys/kernel/config/gpio-sim"
+// enough for every line the wiringPi pins map to
+#define SIM_LINES 32
+
+static char simDir[64];
+static char bankDir[96];
+static char chipName[32];
+static char devName[32];
+static int failures = 0;
+
+static bool WriteFile(const char * path, const char * value)
+{
+	const int fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return false;
+	const bool bOk = write(fd, value, strlen(value)) == (ssize_t) strlen(value);
+	close(fd);
+	return bOk;
+}
+
+static bool ReadFile(const char * path, char * value, size_t size)
+{
+	const int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	const ssize_t len = read(fd, value, size - 1);
+	close(fd);
+	if (len <= 0)
+		return false;
+	value[len] = 0;
+	value[strcspn(value, "\n")] = 0;
+	return true;
+}
+
+static void RemoveChip()
+{
+	char path[128];
+	snprintf(path, sizeof(path), "%s/live", simDir);
+	WriteFile(path, "0");
+	rmdir(bankDir);
+	rmdir(simDir);
+}
+
+// Make a chip of SIM_LINES lines.  Returns SKIP if gpio-sim can't be had here, 1 if it goes wrong after that.
+static int MakeChip()
+{
+	struct stat st;
+	if ((stat(CONFIGFS, &st) != 0) || !S_ISDIR(st.st_mode))
+	{
+		printf("gpio-sim isn't in configfs (modprobe gpio-sim), skipping\n");
+		return SKIP;
+	}
+	snprintf(simDir, sizeof(simDir), CONFIGFS "/sprinklers%d", (int) getpid());
+	snprintf(bankDir, sizeof(bankDir), "%s/bank0", simDir);
+	if (mkdir(simDir, 0755) != 0)
+	{
+		printf("Can't make %s (%s), skipping\n", simDir, strerror(errno));
+		return SKIP;
+	}
+	char path[128];
+	char lines[8];
+	snprintf(path, sizeof(path), "%s/num_lines", bankDir);
+	snprintf(lines, sizeof(lines), "%d", SIM_LINES);
+	if ((mkdir(bankDir, 0755) != 0) || !WriteFile(path, lines))
+	{
+		printf("Can't set up %s (%s)\n", bankDir, strerror(errno));
+		RemoveChip();
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/live", simDir);
+	if (!WriteFile(path, "1"))
+	{
+		printf("Can't bring up the chip (%s)\n", strerror(errno));
+		RemoveChip();
+		return 1;
+	}
+	char chip_path[128];
+	snprintf(path, sizeof(path), "%s/dev_name", simDir);
+	snprintf(chip_path, sizeof(chip_path), "%s/chip_name", bankDir);
+	if (!ReadFile(path, devName, sizeof(devName)) || !ReadFile(chip_path, chipName, sizeof(chipName)))
+	{
+		printf("Can't find the chip that was made\n");
+		RemoveChip();
+		return 1;
+	}
+	return 0;
+}
+
+static void Check(bool bOk, const char * what, int output, int line)
+{
+	if (bOk)
+		return;
+	printf("FAIL: output %d, line %d: %s\n", output, line, what);
+	failures++;
+}
+
+// The level gpio-sim has the line at, -1 if it can't be read
+static int LineLevel(int line)
+{
+	char path[128];
+	char value[8];
+	snprintf(path, sizeof(path), "/sys/devices/platform/%s/%s/sim_gpio%d/value", devName, chipName, line);
+	if (!ReadFile(path, value, sizeof(value)))
+		return -1;
+	return atoi(value);
+}
+
+// Check every line of the board against the outputs in state
+static void CheckLines(int chip_fd, bool bNegative, const ZoneSet & state)
+{
+	for (int i = 0; i < DirectOutputs<Board>(); i++)
+	{
+		const int line = WiringPiToGpio(Board::pins[i]);
+		struct gpio_v2_line_info info;
+		memset(&info, 0, sizeof(info));
+		info.offset = line;
+		if (ioctl(chip_fd, GPIO_V2_GET_LINEINFO_IOCTL, &info) < 0)
+		{
+			Check(false, "no line info", i, line);
+			continue;
+		}
+		Check(info.flags & GPIO_V2_LINE_FLAG_USED, "not requested", i, line);
+		Check(info.flags & GPIO_V2_LINE_FLAG_OUTPUT, "not an output", i, line);
+		Check(((info.flags & GPIO_V2_LINE_FLAG_ACTIVE_LOW) != 0) == bNegative, bNegative ? "not active low" : "active low", i, line);
+		// on is high, or for negative low
+		Check(LineLevel(line) == (state.Test(i) != bNegative), "wrong level", i, line);
+	}
+}
+
+static void TestOutput(bool bNegative)
+{
+	printf("Direct %s\n", bNegative ? "Negative" : "Positive");
+	char chip[64];
+	snprintf(chip, sizeof(chip), "/dev/%s", chipName);
+	Output * output = NewDirectOutput(chip, bNegative);
+	if (!output->Setup())
+	{
+		Check(false, "setup failed", -1, -1);
+		delete output;
+		return;
+	}
+	const int chip_fd = open(chip, O_RDWR | O_CLOEXEC);
+	if (chip_fd < 0)
+	{
+		Check(false, "can't open the chip", -1, -1);
+		delete output;
+		return;
+	}
+
+	// all off from setup
+	ZoneSet state;
+	CheckLines(chip_fd, bNegative, state);
+	// the pump and a few zones
+	state.Set(0);
+	state.Set(2);
+	state.Set(DirectOutputs<Board>() - 1);
+	output->Latch(state);
+	CheckLines(chip_fd, bNegative, state);
+	// and then others, so a line left on shows
+	state.Clear();
+	state.Set(1);
+	output->Latch(state);
+	CheckLines(chip_fd, bNegative, state);
+
+	close(chip_fd);
+	delete output;
+}
+
+int main()
+{
+	const int ret = MakeChip();
+	if (ret != 0)
+		return ret;
+	TestOutput(false);
+	TestOutput(true);
+	RemoveChip();
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+// shift_register_test.cpp
+// Latches outputs into the shift register with a plain file standing in for the SPI device, and checks the
+//  bytes written: the last register's first, the pump as bit 0 of the last byte, and nothing written when
+//  the outputs haven't changed.  Also checks a device that isn't SPI isn't taken for a file.
+//
+
+#include "ShiftRegister.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void Check(bool bOk, const char * what)
+{
+	if (bOk)
+		return;
+	printf("FAIL: %s\n", what);
+	failures++;
+}
+
+// The bytes the register should get for the outputs in state, the first one furthest along the chain
+static void Expected(const ZoneSet & state, uint8_t * bytes)
+{
+	memset(bytes, 0, SR_REGISTERS);
+	for (int output = 0; output <= NUM_ZONES; output++)
+		if (state.Test(output))
+			bytes[SR_REGISTERS - 1 - output / 8] |= 1 << (output % 8);
+}
+
+static void CheckFile(int fd, const uint8_t * expected, const char * what)
+{
+	uint8_t bytes[SR_REGISTERS];
+	const bool bRead = pread(fd, bytes, sizeof(bytes), 0) == (ssize_t) sizeof(bytes);
+	if (bRead && (memcmp(bytes, expected, sizeof(bytes)) == 0))
+		return;
+	printf("FAIL: %s:", what);
+	for (int i = 0; bRead && (i < SR_REGISTERS); i++)
+		printf(" %02x (expected %02x)", bytes[i], expected[i]);
+	printf("\n");
+	failures++;
+}
+
+int main()
+{
+	char path[] = "/tmp/shiftregXXXXXX";
+	const int fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+
+	ShiftRegister reg;
+	Check(reg.Open(path, "", 0, 0, 0), "a plain file isn't taken");
+	uint8_t expected[SR_REGISTERS];
+
+	// the pump alone is the lowest bit of the last byte
+	ZoneSet state;
+	state.Set(0);
+	Check(reg.Shift(state), "shift failed");
+	Expected(state, expected);
+	Check(expected[SR_REGISTERS - 1] == 0x01, "the pump isn't bit 0 of the last byte");
+	CheckFile(fd, expected, "pump");
+
+	// zones across the chain, the last one in the first byte
+	state.Clear();
+	state.Set(1);
+	state.Set(8);
+	state.Set(NUM_ZONES);
+	Check(reg.Shift(state), "shift failed");
+	Expected(state, expected);
+	CheckFile(fd, expected, "zones");
+	Check(reg.Shifts() == 2, "not shifted out once for each change");
+
+	// the same outputs again aren't written
+	const uint8_t scribble[SR_REGISTERS] = {0xa5};
+	Check(pwrite(fd, scribble, sizeof(scribble), 0) == (ssize_t) sizeof(scribble), "can't write the file");
+	Check(reg.Shift(state), "shift failed");
+	CheckFile(fd, scribble, "unchanged outputs were written");
+	Check(reg.Shifts() == 2, "unchanged outputs were counted as a shift");
+
+	// and all off is
+	state.Clear();
+	Check(reg.Shift(state), "shift failed");
+	Expected(state, expected);
+	CheckFile(fd, expected, "all off");
+	reg.Close();
+
+	// a character device that won't take the SPI mode is an error, so the pins are used instead
+	Check(!reg.Open("/dev/null", "", 0, 0, 0), "/dev/null taken for the register");
+	Check(!reg.IsOpen(), "left open after failing");
+
+	close(fd);
+	unlink(path);
+	printf("%s\n", failures ? "FAILED" : "OK");
+	return failures ? 1 : 0;
+}
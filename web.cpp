@@ -6,6 +6,7 @@
 
 #include "web.h"
 #include "settings.h"
+#include "Controller.h"
 #ifdef ARDUINO
 #include "nntp.h"
 #endif
@@ -31,6 +32,12 @@
 #include "Event.h"
 #include <unistd.h>
 #include "core.h"
+#include "Conflicts.h"
+#include "Solar.h"
+#ifndef ARDUINO
+#include "Coprocess.h"
+#include "FlowMeter.h"
+#endif
 
 web::web(void)
 		: m_server(0)
@@ -125,7 +132,6 @@ static void ServeError(FILE * stream_file)
 
 static void JSONSchedules(const KVPairs & key_value_pairs, FILE * stream_file)
 {
-	const time_t local_now = nntpTimeServer.LocalNow();
 	ServeHeader(stream_file, 200, "OK", false, "text/plain");
 	int iNumSchedules = GetNumSchedules();
 	fprintf(stream_file, "{\n\"Table\" : [\n");
@@ -134,19 +140,38 @@ static void JSONSchedules(const KVPairs & key_value_pairs, FILE * stream_file)
 	for (int i = 0; i < iNumSchedules; i++)
 	{
 		LoadSchedule(i, &sched);
-        sched.NextRun(local_now, buff);
+		const CalendarDays days = controller->m_calendar.Days(i, sched, tickTime);
+        sched.NextRun(days, tickTime, buff);
 		fprintf_P(stream_file, PSTR("%s\t{\"id\": %d, \"name\": \"%s\", \"e\": \"%s\", \"td\": %s, \"tm\": %s, \"next\": \"%s\"}"),
                   (i == 0) ? "" : ",\n",
                   i,
                   sched.name,
                   sched.IsEnabled() ? "on" : "off",
-                  GetRunSchedules() && sched.IsRunToday(local_now) ? "true" : "false",
-                  GetRunSchedules() && sched.IsRunTomorrow(local_now) ? "true" : "false",
+                  GetRunSchedules() && (days & 0x01) ? "true" : "false",
+                  GetRunSchedules() && (days & 0x02) ? "true" : "false",
                   buff);
 	}
 	fprintf(stream_file, "\n]}");
 }
 
+// The runs of a schedule that overlap other runs over the next week, sent back when it's saved.
+static void JSONConflicts(uint8_t sched_num, FILE * stream_file)
+{
+	Conflict conflicts[20];
+	const int count = FindConflicts(sched_num, tickTime, conflicts, sizeof(conflicts) / sizeof(conflicts[0]));
+	ServeHeader(stream_file, 200, "OK", false, "text/plain");
+	fprintf_P(stream_file, PSTR("{\n\t\"id\" : \"%d\",\n\t\"conflicts\" : [\n"), sched_num);
+	for (int i = 0; i < count; i++)
+	{
+		Schedule other;
+		LoadSchedule(conflicts[i].other.sched, &other);
+		fprintf_P(stream_file, PSTR("%s\t\t{\"start\" : \"%lu\", \"end\" : \"%lu\", \"with\" : \"%d\", \"name\" : \"%s\", \"wstart\" : \"%lu\", \"wend\" : \"%lu\"}"),
+				(i == 0) ? "" : ",\n", conflicts[i].window.start, conflicts[i].window.end, conflicts[i].other.sched, other.name,
+				conflicts[i].other.start, conflicts[i].other.end);
+	}
+	fprintf_P(stream_file, PSTR("\n\t]\n}"));
+}
+
 static void JSONZones(const KVPairs & key_value_pairs, FILE * stream_file)
 {
 	ServeHeader(stream_file, 200, "OK", false, "text/plain");
@@ -155,8 +180,8 @@ static void JSONZones(const KVPairs & key_value_pairs, FILE * stream_file)
 	for (int i = 0; i < NUM_ZONES; i++)
 	{
 		LoadZone(i, &zone);
-		fprintf_P(stream_file, PSTR("%s\t{\"name\" : \"%s\", \"enabled\" : \"%s\", \"pump\" : \"%s\", \"state\" : \"%s\" }"), (i == 0) ? "" : ",\n", zone.name,
-				zone.bEnabled ? "on" : "off", zone.bPump ? "on" : "off", isZoneOn(i + 1) ? "on" : "off");
+		fprintf_P(stream_file, PSTR("%s\t{\"name\" : \"%s\", \"enabled\" : \"%s\", \"pump\" : \"%s\", \"flow\" : \"%u\", \"cycle\" : \"%u\", \"soak\" : \"%u\", \"state\" : \"%s\" }"),
+				(i == 0) ? "" : ",\n", zone.name, zone.bEnabled ? "on" : "off", zone.bPump ? "on" : "off", zone.flow, zone.cycle, zone.soak, isZoneOn(i + 1) ? "on" : "off");
 	}
 	fprintf(stream_file, "\n]}");
 }
@@ -194,7 +219,7 @@ static void JSONLogs(const KVPairs & key_value_pairs, FILE * stream_file)
 		}
 	}
 
-	logger.GraphZone(stream_file, sdate, edate, grouping);
+	controller->m_logger.GraphZone(stream_file, sdate, edate, grouping);
 	fprintf(stream_file, "}");
 }
 
@@ -218,7 +243,7 @@ static void JSONtLogs(const KVPairs & key_value_pairs, FILE * stream_file)
 			edate = strtol(value, 0, 10);
 		}
 	}
-	logger.TableZone(stream_file, sdate, edate);
+	controller->m_logger.TableZone(stream_file, sdate, edate);
 	fprintf(stream_file, "\t]\n}");
 }
 
@@ -243,6 +268,7 @@ static void JSONSettings(const KVPairs & key_value_pairs, FILE * stream_file)
 #endif
 	fprintf_P(stream_file, PSTR("\t\"webport\" : \"%u\",\n"), GetWebPort());
 	fprintf_P(stream_file, PSTR("\t\"ot\" : \"%d\",\n"), GetOT());
+	fprintf_P(stream_file, PSTR("\t\"cap\" : \"%u\",\n"), GetFlowCapacity());
 	ip = GetWUIP();
 	fprintf_P(stream_file, PSTR("\t\"wuip\" : \"%d.%d.%d.%d\",\n"), ip[0], ip[1], ip[2], ip[3]);
 #if defined(WEATHER_WUNDERGROUND)
@@ -316,19 +342,94 @@ static void JSONState(const KVPairs & key_value_pairs, FILE * stream_file)
 	ServeHeader(stream_file, 200, "OK", false, "text/plain");
 	fprintf_P(stream_file,
 			PSTR("{\n\t\"version\" : \"%s\",\n\t\"run\" : \"%s\",\n\t\"zones\" : \"%d\",\n\t\"schedules\" : \"%d\",\n\t\"timenow\" : \"%lu\",\n\t\"events\" : \"%d\""),
-			VERSION, GetRunSchedules() ? "on" : "off", GetNumEnabledZones(), GetNumSchedules(), nntpTimeServer.LocalNow(), iNumEvents);
-	if (runState.isSchedule() || runState.isManual())
+			VERSION, GetRunSchedules() ? "on" : "off", GetNumEnabledZones(), GetNumSchedules(), tickTime.local, controller->m_iNumEvents);
+	if (SchedulesHeld())
+		fprintf_P(stream_file, PSTR(",\n\t\"held\" : \"rain\""));
+#ifndef ARDUINO
+	// litres a minute through the meter now
+	if (flowMeter.IsCounting())
+		fprintf(stream_file, ",\n\t\"flow\" : \"%.2f\"", (float) flowMeter.Rate() / FLOW_PULSES_PER_LITRE);
+	// to keep an eye on the SD card's wear
+	fprintf(stream_file, ",\n\t\"settingswrites\" : \"%u\",\n\t\"settingsbytes\" : \"%llu\"", (unsigned) controller->m_eeprom.Writes(),
+			(unsigned long long) controller->m_eeprom.BytesWritten());
+#endif
+	if (controller->m_runState.isSchedule() || controller->m_runState.isManual())
 	{
-		FullZone zone;
-		LoadZone(runState.getZone() - 1, &zone);
-		long time_check = runState.getEndTime() * 60L - (nntpTimeServer.LocalNow() - previousMidnight(nntpTimeServer.LocalNow()));
-		if (runState.isManual())
+		FullZone zone = {0};
+		long time_check = 0;
+		if (controller->m_runState.getZone() > 0)
+		{
+			LoadZone(controller->m_runState.getZone() - 1, &zone);
+			time_check = controller->m_runState.getEndTime() - tickTime.seconds;
+		}
+		else  // between cycles with every zone soaking
+			strcpy(zone.name, "Soaking");
+		if (controller->m_runState.isManual())
 			time_check = 99999;
 		fprintf_P(stream_file, PSTR(",\n\t\"onzone\" : \"%s\",\n\t\"offtime\" : \"%ld\""), zone.name, time_check);
 	}
 	fprintf_P(stream_file, (PSTR("\n}")));
 }
 
+#define MAX_PLAN_DAYS 366
+
+struct PlanTotals
+{
+	FILE * stream_file;
+	time_t today;
+	int iNumRuns;
+	unsigned long zone_runs[NUM_ZONES];
+	unsigned long zone_seconds[NUM_ZONES];
+	unsigned long day_seconds[MAX_PLAN_DAYS];
+};
+
+static void PlanRun(const PlannedRun & run, void * context)
+{
+	PlanTotals * totals = (PlanTotals *) context;
+	const long seconds = run.end - run.start;
+	fprintf_P(totals->stream_file, PSTR("%s\t\t{\"sched\" : \"%d\", \"zone\" : \"%d\", \"start\" : \"%lu\", \"end\" : \"%lu\"}"),
+			(totals->iNumRuns == 0) ? "" : ",\n", run.sched, run.zone, run.start, run.end);
+	totals->iNumRuns++;
+	totals->zone_runs[run.zone - 1]++;
+	totals->zone_seconds[run.zone - 1] += seconds;
+	totals->day_seconds[(run.start - totals->today) / SECS_PER_DAY] += seconds;
+}
+
+static void JSONPlan(const KVPairs & key_value_pairs, FILE * stream_file)
+{
+	int days = 7;
+	bool bWeather = false;
+	// Iterate through the kv pairs and search for the number of days.
+	for (int i = 0; i < key_value_pairs.num_pairs; i++)
+	{
+		const char * key = key_value_pairs.keys[i];
+		const char * value = key_value_pairs.values[i];
+		if (strcmp(key, "days") == 0)
+			days = spi_max(1, spi_min(atoi(value), MAX_PLAN_DAYS));
+		else if (strcmp(key, "weather") == 0)
+			bWeather = strcmp(value, "on") == 0;
+	}
+
+	static PlanTotals totals;
+	memset(&totals, 0, sizeof(totals));
+	totals.stream_file = stream_file;
+	totals.today = previousMidnight(tickTime.local);
+
+	ServeHeader(stream_file, 200, "OK", false, "text/plain");
+	fprintf_P(stream_file, PSTR("{\n\t\"days\" : \"%d\",\n\t\"seasonal\" : \"%d\",\n\t\"weather\" : \"%d\",\n\t\"runs\" : [\n"),
+			days, GetSeasonalAdjust(), bWeather ? GetLastWeatherScale() : -1);
+	BuildPlan(tickTime, days, bWeather, PlanRun, &totals);
+	fprintf_P(stream_file, PSTR("\n\t],\n\t\"zones\" : [\n"));
+	for (int i = 0; i < NUM_ZONES; i++)
+		fprintf_P(stream_file, PSTR("%s\t\t{\"zone\" : \"%d\", \"runs\" : \"%lu\", \"minutes\" : \"%.1f\"}"), (i == 0) ? "" : ",\n", i + 1,
+				totals.zone_runs[i], totals.zone_seconds[i] / 60.0);
+	fprintf_P(stream_file, PSTR("\n\t],\n\t\"daily\" : [\n"));
+	for (int i = 0; i < days; i++)
+		fprintf_P(stream_file, PSTR("%s\t\t{\"date\" : \"%lu\", \"minutes\" : \"%.1f\"}"), (i == 0) ? "" : ",\n",
+				totals.today + i * SECS_PER_DAY, totals.day_seconds[i] / 60.0);
+	fprintf_P(stream_file, PSTR("\n\t]\n}"));
+}
+
 static void JSONSchedule(const KVPairs & key_value_pairs, FILE * stream_file)
 {
 	int sched_num = -1;
@@ -371,18 +472,35 @@ static void JSONSchedule(const KVPairs & key_value_pairs, FILE * stream_file)
 		{
 			fprintf_P(stream_file, PSTR("%s\t\t{\"t\" : \"00:00\", \"e\" : \"off\" }"), (i == 0) ? "" : ",\n");
 		}
+		else if (sched.time[i] & (TIME_SUNRISE | TIME_SUNSET))
+		{
+			char offset[8] = "";
+			if (TimeOffset(sched.time[i]) != 0)
+				sprintf(offset, "%+d", TimeOffset(sched.time[i]));
+			fprintf_P(stream_file, PSTR("%s\t\t{\"t\" : \"%s%s\", \"e\" : \"on\" }"), (i == 0) ? "" : ",\n",
+					(sched.time[i] & TIME_SUNRISE) ? "SR" : "SS", offset);
+		}
 		else
 		{
 			fprintf_P(stream_file, PSTR("%s\t\t{\"t\" : \"%02d:%02d\", \"e\" : \"on\" }"), (i == 0) ? "" : ",\n", sched.time[i] / 60, sched.time[i] % 60);
 		}
 	}
-	fprintf_P(stream_file, PSTR("\n\t],\n\t\"zones\" : [\n"));
+	char cron[200] = "";
+	if (sched.IsCron())
+		sched.cron.Format(cron, sizeof(cron));
+	fprintf_P(stream_file, PSTR("\n\t],\n\t\"cron\" : \"%s\",\n\t\"zones\" : [\n"), cron);
 	for (int i = 0; i < NUM_ZONES; i++)
 	{
 		FullZone zone;
 		LoadZone(i, &zone);
-		fprintf(stream_file, "%s\t\t{\"name\" : \"%s\", \"e\":\"%s\", \"duration\" : %d}", (i == 0) ? "" : ",\n", zone.name, zone.bEnabled ? "on" : "off",
-				sched.zone_duration[i]);
+		// durations are in minutes, with enough decimals to get the seconds back exactly
+		char duration[10];
+		if (sched.zone_duration[i] % 60)
+			sprintf(duration, "%.2f", sched.zone_duration[i] / 60.0);
+		else
+			sprintf(duration, "%u", sched.zone_duration[i] / 60);
+		fprintf(stream_file, "%s\t\t{\"name\" : \"%s\", \"e\":\"%s\", \"duration\" : %s}", (i == 0) ? "" : ",\n", zone.name, zone.bEnabled ? "on" : "off",
+				duration);
 	}
 	fprintf(stream_file, " ]\n}");
 }
@@ -400,9 +518,11 @@ static bool SetQSched(const KVPairs & key_value_pairs)
 	{
 		const char * key = key_value_pairs.keys[i];
 		const char * value = key_value_pairs.values[i];
-		if ((key[0] == 'z') && (key[1] > 'a') && (key[1] <= ('a' + NUM_ZONES)) && (key[2] == 0))
+		const char * rest;
+		const int zone = ParseZoneKey(key, &rest);
+		if ((zone != -1) && (*rest == 0))
 		{
-			quickSchedule.zone_duration[key[1] - 'b'] = atoi(value);
+			controller->m_quickSchedule.zone_duration[zone] = ParseDuration(value);
 		}
 		if (strcmp(key, "sched") == 0)
 		{
@@ -421,12 +541,40 @@ static void ServeEventPage(FILE * stream_file)
 {
 	ServeHeader(stream_file, 200, "OK", false);
 	freeMemory();
-	const time_t timeNow = nntpTimeServer.LocalNow();
-	fprintf_P(stream_file, PSTR("<h1>%d Events</h1><h3>%02d:%02d:%02d %d/%d/%d (%d)</h3>"), iNumEvents, hour(timeNow), minute(timeNow), second(timeNow),
-			year(timeNow), month(timeNow), day(timeNow), weekday(timeNow));
-	for (uint8_t i = 0; i < iNumEvents; i++)
-		fprintf_P(stream_file, PSTR("Event [%02d] Time:%02d:%02d(%d) Command %d data %d,%d<br/>"), i, events[i].time / 60, events[i].time % 60, events[i].time,
-				events[i].command, events[i].data[0], events[i].data[1]);
+	const TimeContext & now = tickTime;
+	fprintf_P(stream_file, PSTR("<h1>%d Events</h1><h3>%02d:%02d:%02d %d/%d/%d (%d)</h3>"), controller->m_iNumEvents, now.hour, now.minutes % 60, (int)(now.seconds % 60),
+			now.year, now.month, now.mday, now.weekday);
+#if !defined(ARDUINO) && !defined(SIMULATOR)
+	fprintf_P(stream_file, PSTR("Settings written %u times, %llu bytes<br/>"), (unsigned)controller->m_eeprom.Writes(),
+			(unsigned long long)controller->m_eeprom.BytesWritten());
+	if (GetOT() == OT_COPROCESS)
+	{
+		const Coprocess * coprocess = static_cast<Coprocess *>(controller->m_output);
+		fprintf_P(stream_file, PSTR("Script %s Last:%ldms Max:%ldms Outstanding:%u Restarts:%d<br/>"), coprocess->IsRunning() ? "running" : "stopped",
+				coprocess->LastLatency(), coprocess->MaxLatency(), (unsigned)coprocess->Outstanding(), coprocess->Restarts());
+	}
+	else if (GetOT() == OT_SIMULATED)
+	{
+		// the outputs as they've been latched, oldest first
+		const SimulatedOutput * sim = static_cast<SimulatedOutput *>(controller->m_output);
+		for (uint32_t n = spi_max(sim->Latches(), (uint32_t)SimulatedOutput::KEPT) - SimulatedOutput::KEPT; n < sim->Latches(); n++)
+		{
+			const SimulatedOutput::Transition * t = sim->GetTransition(n);
+			if (!t)
+				continue;
+			fprintf_P(stream_file, PSTR("Latch [%u] Time:%ld Outputs:"), (unsigned)n, (long)t->time);
+			for (int i = t->state.Next(-1); i != -1; i = t->state.Next(i))
+				fprintf_P(stream_file, PSTR(" %d"), i);
+			fprintf_P(stream_file, PSTR("<br/>"));
+		}
+	}
+#endif
+	for (int i = 0; i < controller->m_iNumEvents; i++)
+	{
+		const Event & event = controller->m_events[i];
+		fprintf_P(stream_file, PSTR("Event [%02d] Time:%02ld:%02ld:%02ld(%ld) Command %d data %d,%d<br/>"), i, event.time / 3600, (event.time / 60) % 60, event.time % 60, event.time,
+				event.command, event.data[0], event.data[1]);
+	}
 }
 
 static void ServeSchedPage(FILE * stream_file)
@@ -444,7 +592,13 @@ static void ServeSchedPage(FILE * stream_file)
 		else
 			fprintf_P(stream_file, PSTR("Not Enabled"));
 		fprintf_P(stream_file, PSTR("<br/>Name:%s<br/>"), sched.name);
-		if (sched.IsInterval())
+		if (sched.IsCron())
+		{
+			char cron[200];
+			sched.cron.Format(cron, sizeof(cron));
+			fprintf_P(stream_file, PSTR("Cron : %s"), cron);
+		}
+		else if (sched.IsInterval())
 			fprintf_P(stream_file, PSTR("Interval : %d"), sched.interval);
 		else
 		{
@@ -466,9 +620,12 @@ static void ServeSchedPage(FILE * stream_file)
 			fprintf_P(stream_file, PSTR("(%d)"), sched.day);
 		}
 		for (uint8_t i = 0; i < 4; i++)
-			fprintf_P(stream_file, PSTR("<br/>Time %d:%02d:%02d(%d)"), i + 1, sched.time[i] / 60, sched.time[i] % 60, sched.time[i]);
+		{
+			const short start = StartMinute(sched.time[i], tickTime.day, tickTime.offset);
+			fprintf_P(stream_file, PSTR("<br/>Time %d:%02d:%02d(%d)"), i + 1, start / 60, start % 60, sched.time[i]);
+		}
 		for (uint8_t i = 0; i < NUM_ZONES; i++)
-			fprintf_P(stream_file, PSTR("<br/>Zone %d Duration:%d"), i + 1, sched.zone_duration[i]);
+			fprintf_P(stream_file, PSTR("<br/>Zone %d Duration:%d:%02d"), i + 1, sched.zone_duration[i] / 60, sched.zone_duration[i] % 60);
 	}
 }
 
@@ -524,9 +681,10 @@ static bool ManualZone(const KVPairs & key_value_pairs)
 	{
 		const char * key = key_value_pairs.keys[i];
 		const char * value = key_value_pairs.values[i];
-		if ((strcmp(key, "zone") == 0) && (value[0] == 'z') && (value[1] > 'a') && (value[1] <= ('a' + NUM_ZONES)))
+		const char * rest;
+		if ((strcmp(key, "zone") == 0) && (ParseZoneKey(value, &rest) != -1) && (*rest == 0))
 		{
-			iZoneNum = value[1] - 'a';
+			iZoneNum = ParseZoneKey(value) + 1;
 		}
 		else if (strcmp(key, "state") == 0)
 		{
@@ -539,12 +697,12 @@ static bool ManualZone(const KVPairs & key_value_pairs)
 	if ((iZoneNum >= 0) && bOn)
 	{
 		TurnOnZone(iZoneNum);
-		runState.SetManual(true, iZoneNum);
+		controller->m_runState.SetManual(true, iZoneNum);
 	}
 	else
 	{
 		TurnOffZones();
-		runState.SetManual(false);
+		controller->m_runState.SetManual(false);
 	}
 	return true;
 }
@@ -565,9 +723,10 @@ static bool ChatterZone(const KVPairs & key_value_pairs)
 	{
 		const char * key = key_value_pairs.keys[i];
 		const char * value = key_value_pairs.values[i];
-		if ((strcmp(key, "zone") == 0) && (value[0] == 'z') && (value[1] > 'a') && (value[1] <= ('a' + NUM_ZONES)))
+		const char * rest;
+		if ((strcmp(key, "zone") == 0) && (ParseZoneKey(value, &rest) != -1) && (*rest == 0))
 		{
-			iZoneNum = value[1] - 'a';
+			iZoneNum = ParseZoneKey(value) + 1;
 		}
 	}
 	if (iZoneNum >= 0)
@@ -863,24 +1022,40 @@ void web::ProcessWebClients()
 		KVPairs key_value_pairs;
 		char sPage[55];
 
-		if (!ParseHTTPHeader(client, &key_value_pairs, sPage, sizeof(sPage)))
+		// c/<id>/ at the start of the page picks the controller the request is for, otherwise it's for
+		//  the first one.  The pages only use relative links, so they work from under it as they are.
+		const bool bParsed = ParseHTTPHeader(client, &key_value_pairs, sPage, sizeof(sPage));
+		Controller * target = controllers[0];
+		if (bParsed && (sPage[0] == 'c') && (sPage[1] == '/') && isdigit(sPage[2]))
+		{
+			char * end;
+			target = GetController(strtol(sPage + 2, &end, 10));
+			if (*end != '/')
+				target = 0;
+			else
+				memmove(sPage, end + 1, strlen(end + 1) + 1);
+		}
+		if (!bParsed)
 		{
 			trace(F("ERROR!\n"));
 			ServeError(pFile);
 		}
+		else if (!target)
+			Serve404(pFile);
 		else
 		{
+			controller = target;
 
 			trace(F("Page:%s\n"), sPage);
 			//ShowSockStatus();
 
 			if (strcmp(sPage, "bin/setSched") == 0)
 			{
-				if (SetSchedule(key_value_pairs))
+				int sched_num = -1;
+				if (SetSchedule(key_value_pairs, &sched_num))
 				{
-					if (GetRunSchedules())
-						ReloadEvents();
-					ServeHeader(pFile, 200, "OK", false);
+					ScheduleChanged(sched_num);
+					JSONConflicts(sched_num, pFile);
 				}
 				else
 					ServeError(pFile);
@@ -889,7 +1064,7 @@ void web::ProcessWebClients()
 			{
 				if (SetZones(key_value_pairs))
 				{
-					ReloadEvents();
+					// zone settings are read when each run starts, so there's nothing to reload
 					ServeHeader(pFile, 200, "OK", false);
 				}
 				else
@@ -897,10 +1072,10 @@ void web::ProcessWebClients()
 			}
 			else if (strcmp(sPage, "bin/delSched") == 0)
 			{
-				if (DeleteSchedule(key_value_pairs))
+				int sched_num = -1;
+				if (DeleteSchedule(key_value_pairs, &sched_num))
 				{
-					if (GetRunSchedules())
-						ReloadEvents();
+					ScheduleDeleted(sched_num);
 					ServeHeader(pFile, 200, "OK", false);
 				}
 				else
@@ -919,7 +1094,8 @@ void web::ProcessWebClients()
 			{
 				if (SetSettings(key_value_pairs))
 				{
-					ReloadEvents();
+					// the time zone may have moved which start times are still to come today
+					ReloadStartEvents();
 					ServeHeader(pFile, 200, "OK", false);
 				}
 				else
@@ -947,7 +1123,11 @@ void web::ProcessWebClients()
 			{
 				if (RunSchedules(key_value_pairs))
 				{
-					ReloadEvents();
+					// turning the system off stops everything, turning it on just queues up today's start times
+					if (GetRunSchedules())
+						ReloadStartEvents();
+					else
+						ReloadEvents();
 					ServeHeader(pFile, 200, "OK", false);
 				}
 				else
@@ -984,6 +1164,10 @@ void web::ProcessWebClients()
 			{
 				JSONSchedule(key_value_pairs, pFile);
 			}
+			else if (strcmp(sPage, "json/plan") == 0)
+			{
+				JSONPlan(key_value_pairs, pFile);
+			}
 			else if (strcmp(sPage, "json/wcheck") == 0)
 			{
 				JSONwCheck(key_value_pairs, pFile);
@@ -1050,6 +1234,7 @@ void web::ProcessWebClients()
 #endif
 		// close the connection:
 		client.stop();
+		controller = controllers[0];
 
 		if (bReset)
 			sysreset();
@@ -7,10 +7,15 @@
 #ifndef _WEB_h
 #define _WEB_h
 
+#include "config.h"
+
 class EthernetServer;
 
-// total number of kv pairs
-#define NUM_KEY_VALUES 50
+// pairs each zone sends when the zones are saved: name, e(nabled), p(ump), f(low), c(ycle) and s(oak).
+//  Add to this with each new zone field, or the later zones' pairs don't fit and the save fails.
+#define ZONE_KEY_VALUES 6
+// total number of kv pairs, enough for every zone's settings and a few more
+#define NUM_KEY_VALUES (NUM_ZONES * ZONE_KEY_VALUES + 20)
 // largest allowed key
 #define KEY_SIZE 10
 // largest allowed value